@@ -0,0 +1,268 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buddha.h"
+#include "iterbatch.h"
+#include "iterbuf.h"
+
+// Where c gets drawn from; the whole Mandelbrot set fits in here
+static const complex_region sample_domain = MANDELBROT_DEFAULT_REGION;
+
+// xorshift64*, one stream per thread
+static unsigned long long rng_next(unsigned long long * state)
+{
+  unsigned long long x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 2685821657736338717ull;
+}
+
+static double rng_uniform(unsigned long long * state)
+{
+  return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// c in the main cardioid or the period-2 bulb never escapes
+static int known_interior(complex c)
+{
+  double x = c.r - 0.25;
+  double q = x * x + c.i * c.i;
+  if (q * (q + x) <= 0.25 * c.i * c.i) return 1;
+  double y = c.r + 1;
+  return y * y + c.i * c.i <= 0.0625;
+}
+
+static complex cell_point(int cell, unsigned long long * rng)
+{
+  const double cw = (sample_domain.bottomright.r - sample_domain.topleft.r)
+    / BUDDHA_GRID;
+  const double ch = (sample_domain.bottomright.i - sample_domain.topleft.i)
+    / BUDDHA_GRID;
+  complex c;
+  c.r = sample_domain.topleft.r + cw * (cell % BUDDHA_GRID + rng_uniform(rng));
+  c.i = sample_domain.topleft.i + ch * (cell / BUDDHA_GRID + rng_uniform(rng));
+  return c;
+}
+
+/*
+  The pilot pass: a cell's weight is the orbit length its sample
+  points escape with, i.e. how much they would add to the picture.
+  Empty cells keep a small floor so nothing is ruled out entirely.
+*/
+static void build_cells(buddha * b)
+{
+  const int cells = BUDDHA_GRID * BUDDHA_GRID;
+  unsigned long long rng = b->seed ^ 0x9e3779b97f4a7c15ull;
+  double total = 0;
+  int cell, s;
+  for (cell=0; cell<cells; cell++)
+    {
+      double weight = 0;
+      for (s=0; s<BUDDHA_PILOT; s++)
+        {
+          complex c = cell_point(cell, &rng);
+          if (known_interior(c)) continue;
+          complex z = {0,0};
+          unsigned iters = iterate_resume(&z, c, 0, b->maxiters);
+          if (iters < b->maxiters)
+            weight += iters;
+        }
+      b->scale[cell] = weight;
+      total += weight;
+    }
+
+  const double floor = 0.01 * total / cells + 1e-9;
+  total = 0;
+  for (cell=0; cell<cells; cell++)
+    {
+      if (b->scale[cell] < floor) b->scale[cell] = floor;
+      total += b->scale[cell];
+      b->cdf[cell] = total;
+    }
+
+  // An orbit from a cell drawn p times as often as uniform counts 1/p
+  const double mean = total / cells;
+  for (cell=0; cell<cells; cell++)
+    b->scale[cell] = mean / b->scale[cell];
+}
+
+static int pick_cell(const buddha * b, unsigned long long * rng)
+{
+  const int cells = BUDDHA_GRID * BUDDHA_GRID;
+  double u = rng_uniform(rng) * b->cdf[cells - 1];
+  int lo = 0, hi = cells - 1;
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (b->cdf[mid] <= u)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+int buddha_init(buddha * b, int w, int h, complex_region region,
+                unsigned maxiters, unsigned threads)
+{
+  if (threads == 0) threads = 1;
+  b->w = w;
+  b->h = h;
+  b->region = region;
+  b->maxiters = maxiters;
+  b->threads = threads;
+  b->seed = 0x853c49e6748fea9bull;
+  b->density = calloc((size_t) w * h, sizeof(float));
+  b->bins = calloc(threads, sizeof(float *));
+  b->cdf = malloc(sizeof(double) * BUDDHA_GRID * BUDDHA_GRID);
+  b->scale = malloc(sizeof(float) * BUDDHA_GRID * BUDDHA_GRID);
+  if (!b->density || !b->bins || !b->cdf || !b->scale)
+    {
+      buddha_free(b);
+      return -1;
+    }
+  unsigned t;
+  for (t=0; t<threads; t++)
+    if ((b->bins[t] = calloc((size_t) w * h, sizeof(float))) == NULL)
+      {
+        buddha_free(b);
+        return -1;
+      }
+
+  build_cells(b);
+  b->samples = 0;
+  return 0;
+}
+
+void buddha_free(buddha * b)
+{
+  if (b->bins)
+    {
+      unsigned t;
+      for (t=0; t<b->threads; t++)
+        free(b->bins[t]);
+    }
+  free(b->bins);
+  free(b->density);
+  free(b->cdf);
+  free(b->scale);
+  memset(b, 0, sizeof *b);
+}
+
+void buddha_clear(buddha * b)
+{
+  memset(b->density, 0, sizeof(float) * b->w * b->h);
+  b->samples = 0;
+}
+
+typedef struct
+{
+  buddha * b;
+  float * bins;
+  unsigned long samples;
+  unsigned long long rng;
+}
+sample_job;
+
+static void * sample_thread(void * arg)
+{
+  sample_job * job = arg;
+  const buddha * b = job->b;
+  float * bins = job->bins;
+  const double left = b->region.topleft.r;
+  const double top = b->region.topleft.i;
+  const double xscale = b->w / (b->region.bottomright.r - left);
+  const double yscale = b->h / (b->region.bottomright.i - top);
+
+  unsigned long s;
+  for (s=0; s<job->samples; s++)
+    {
+      int cell = pick_cell(b, &job->rng);
+      complex c = cell_point(cell, &job->rng);
+      if (known_interior(c)) continue;
+
+      // First find out whether it escapes at all, then retrace it
+      complex z = {0,0};
+      unsigned iters = iterate_resume(&z, c, 0, b->maxiters);
+      if (iters >= b->maxiters) continue;
+
+      const float weight = b->scale[cell];
+      unsigned k;
+      z.r = z.i = 0;
+      for (k=1; k<iters; k++)
+        {
+          z = complex_add(complex_mult(z, z), c);
+          int x = (int) floor((z.r - left) * xscale);
+          int y = (int) floor((z.i - top) * yscale);
+          if (x >= 0 && y >= 0 && x < b->w && y < b->h)
+            bins[y * b->w + x] += weight;
+        }
+    }
+  return NULL;
+}
+
+void buddha_sample(buddha * b, unsigned long samples)
+{
+  sample_job jobs[b->threads];
+  pthread_t ids[b->threads];
+  int running[b->threads];
+  unsigned t;
+  for (t=0; t<b->threads; t++)
+    {
+      jobs[t].b = b;
+      jobs[t].bins = b->bins[t];
+      jobs[t].samples = samples / b->threads
+        + (t < samples % b->threads ? 1 : 0);
+      // Fresh stream per thread per batch, so batches don't repeat
+      jobs[t].rng = b->seed + (b->samples + t + 1) * 0x9e3779b97f4a7c15ull;
+    }
+  // This thread takes the first share; any thread that won't start
+  // gets its share done here too
+  for (t=1; t<b->threads; t++)
+    {
+      running[t] = pthread_create(&ids[t], NULL, sample_thread, &jobs[t]) == 0;
+      if (!running[t])
+        sample_thread(&jobs[t]);
+    }
+  sample_thread(&jobs[0]);
+
+  // Fold the private histograms in and clear them for next time
+  const size_t count = (size_t) b->w * b->h;
+  for (t=0; t<b->threads; t++)
+    {
+      if (t > 0 && running[t]) pthread_join(ids[t], NULL);
+      float * bins = b->bins[t];
+      size_t k;
+      for (k=0; k<count; k++)
+        b->density[k] += bins[k];
+      memset(bins, 0, sizeof(float) * count);
+    }
+  b->samples += samples;
+}
+
+void buddha_colorize(const buddha * b, const uint32_t * ramp,
+                     uint32_t * pixels, int pitch)
+{
+  const size_t count = (size_t) b->w * b->h;
+  float peak = 0;
+  size_t k;
+  for (k=0; k<count; k++)
+    if (b->density[k] > peak) peak = b->density[k];
+
+  // Square root keeps the faint outer orbits visible
+  const float scale = peak > 0 ? 255.0f / sqrtf(peak) : 0;
+  int i,j;
+  for (j=0; j<b->h; j++)
+    {
+      const float * row = b->density + (size_t) j * b->w;
+      uint32_t * out = pixels + (size_t) j * pitch;
+      for (i=0; i<b->w; i++)
+        {
+          int v = (int) (sqrtf(row[i]) * scale);
+          out[i] = ramp[v > 255 ? 255 : v];
+        }
+    }
+}
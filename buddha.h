@@ -0,0 +1,58 @@
+#ifndef __BUDDHA_H
+#define __BUDDHA_H
+
+#include <stdint.h>
+#include "complex.h"
+
+/*
+  Orbit-density (Buddhabrot) renderer. Samples c over the Mandelbrot's
+  neighborhood, and for every c that escapes, counts each point its
+  orbit visits on the way out.
+
+  Samples are drawn in batches across several threads. Each thread
+  counts into its own histogram, so there is no sharing while sampling;
+  the histograms are folded into density at the end of each batch,
+  which is when the caller can show progress.
+
+  Sampling is importance-driven: a pilot pass over a grid of cells
+  finds where the long escaping orbits start (near the boundary), and c
+  is drawn from cells in proportion to that. Each orbit is weighted by
+  how much more often its cell gets picked than uniform sampling would
+  pick it, so the picture converges to the same thing uniform sampling
+  would give, only sooner.
+*/
+
+#define BUDDHA_GRID (128)        // pilot cells per side
+#define BUDDHA_PILOT (16)        // pilot samples per cell
+
+typedef struct
+{
+  int w, h;
+  complex_region region;         // the part of the plane being imaged
+  unsigned maxiters;
+  unsigned threads;
+  unsigned long long samples;    // drawn so far
+  unsigned long long seed;
+  float * density;               // merged histogram, w*h
+  float ** bins;                 // one private histogram per thread
+  double * cdf;                  // cumulative cell weights
+  float * scale;                 // per-cell orbit weight
+}
+buddha;
+
+/* Sets up the histograms and runs the pilot pass. Returns 0 on success.
+   The struct must start zeroed. */
+int buddha_init(buddha * b, int w, int h, complex_region region,
+                unsigned maxiters, unsigned threads);
+void buddha_free(buddha * b);
+/* Forgets everything sampled so far */
+void buddha_clear(buddha * b);
+
+/* Draws one batch of samples and merges it into density */
+void buddha_sample(buddha * b, unsigned long samples);
+
+/* Maps density through a 256-entry ramp into a 32bpp pixel array */
+void buddha_colorize(const buddha * b, const uint32_t * ramp,
+                     uint32_t * pixels, int pitch);
+
+#endif
@@ -7,14 +7,21 @@ typedef struct _complex
 }
 complex;
 
+typedef struct
+{
+  complex topleft;
+  complex bottomright;
+}
+complex_region;
+
 // square magnitude
-double complex_sqmag ( const complex c )
+static inline double complex_sqmag ( const complex c )
 {
   return (c.r * c.r) + (c.i * c.i);
 }
 
 // multiply two complex numbers
-complex complex_mult (const complex a, const complex b)
+static inline complex complex_mult (const complex a, const complex b)
 {
   /*
     a + bi, c + di
@@ -27,7 +34,7 @@ complex complex_mult (const complex a, const complex b)
 }
 
 // add two complex numbers
-complex complex_add (const complex a, const complex b)
+static inline complex complex_add (const complex a, const complex b)
 {
   complex ret = {a.r + b.r, a.i + b.i};
   return ret;
@@ -0,0 +1,331 @@
+#include <math.h>
+#include <stdint.h>
+#include "iterbatch.h"
+
+#ifdef ITERBATCH_AVX2
+#include <immintrin.h>
+#endif
+
+// -1 until the CPU has been asked
+static int simd = -1;
+
+static int cpu_has_avx2(void)
+{
+#ifdef ITERBATCH_AVX2
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#else
+  return 0;
+#endif
+}
+
+int iterbatch_simd(void)
+{
+  if (simd < 0) simd = cpu_has_avx2();
+  return simd;
+}
+
+int iterbatch_set_simd(int on)
+{
+  simd = on && cpu_has_avx2();
+  return simd;
+}
+
+unsigned iterate_resume(complex * z, const complex c,
+                        unsigned iters, unsigned maxiters)
+{
+  complex zz = *z;
+
+  while (++iters < maxiters && complex_sqmag(zz) <= 4)
+    zz = complex_add(complex_mult(zz, zz), c);
+
+  *z = zz;
+  return iters;
+}
+
+// Escape count plus how far past the bailout the orbit landed
+static void smooth_counts(size_t n, const double * zr, const double * zi,
+                          const unsigned * iters, unsigned maxiters,
+                          float * smooth)
+{
+  size_t k;
+  for (k=0; k<n; k++)
+    {
+      if (iters[k] >= maxiters)
+        {
+          smooth[k] = maxiters;
+          continue;
+        }
+      double sqmag = zr[k] * zr[k] + zi[k] * zi[k];
+      double nu = iters[k] + 1 - log2(0.5 * log2(sqmag));
+      smooth[k] = nu < 0 ? 0 : nu;
+    }
+}
+
+/*** Double kernel ***/
+
+/*
+  Every lane does the same work each step, with escaped lanes frozen
+  by masks rather than branches, so the lane loops vectorize. The
+  arithmetic is iterate_resume's, term for term, so the counts match
+  it exactly.
+*/
+static void iterate_double_lanes(double * zr, double * zi,
+                                 const double * cr, const double * ci,
+                                 unsigned * iters, int n,
+                                 unsigned start, unsigned maxiters)
+{
+  unsigned char done[ITERBATCH_LANES];
+  int l;
+  for (l=0; l<ITERBATCH_LANES; l++)
+    done[l] = l >= n;
+
+  unsigned k;
+  for (k=start+1; k<maxiters; k++)
+    {
+      int alive = 0;
+      for (l=0; l<ITERBATCH_LANES; l++)
+        {
+          double rr = zr[l] * zr[l];
+          double ii = zi[l] * zi[l];
+          int escaped = rr + ii > 4;
+          iters[l] = escaped && !done[l] ? k : iters[l];
+          done[l] |= escaped;
+          double nzr = (rr - ii) + cr[l];
+          double nzi = (zr[l] * zi[l] + zi[l] * zr[l]) + ci[l];
+          zr[l] = done[l] ? zr[l] : nzr;
+          zi[l] = done[l] ? zi[l] : nzi;
+          alive += !done[l];
+        }
+      if (!alive) return;
+    }
+
+  for (l=0; l<n; l++)
+    if (!done[l])
+      iters[l] = maxiters;
+}
+
+void iterate_batch(size_t n, const double * cr, const double * ci,
+                   double * zr, double * zi,
+                   unsigned start, unsigned maxiters,
+                   unsigned * iters, float * smooth)
+{
+  double lzr[ITERBATCH_LANES], lzi[ITERBATCH_LANES];
+  double lcr[ITERBATCH_LANES], lci[ITERBATCH_LANES];
+  unsigned liters[ITERBATCH_LANES];
+
+  size_t base;
+  for (base=0; base<n; base+=ITERBATCH_LANES)
+    {
+      int m = n - base < ITERBATCH_LANES ? n - base : ITERBATCH_LANES;
+      int l;
+      for (l=0; l<ITERBATCH_LANES; l++)
+        {
+          // Idle lanes still get stepped, so give them something harmless
+          lzr[l] = l < m ? zr[base + l] : 0;
+          lzi[l] = l < m ? zi[base + l] : 0;
+          lcr[l] = l < m ? cr[base + l] : 0;
+          lci[l] = l < m ? ci[base + l] : 0;
+        }
+
+      iterate_double_lanes(lzr, lzi, lcr, lci, liters, m, start, maxiters);
+
+      for (l=0; l<m; l++)
+        {
+          zr[base + l] = lzr[l];
+          zi[base + l] = lzi[l];
+          iters[base + l] = liters[l];
+        }
+    }
+
+  if (smooth)
+    smooth_counts(n, zr, zi, iters, maxiters, smooth);
+}
+
+/*** Fixed-point kernel ***/
+
+typedef int32_t fixed;
+#define FIXED_ESCAPE ((int64_t) 4 << (2 * FIXED_FRAC))
+
+/* Conversions cost as much as a few iterations, so no libm calls:
+   scaling by a power of two is exact, and the rounding is llround's
+   (halves away from zero), done on the truncated value, which is also
+   exact this far below 2^52 */
+static fixed to_fixed(double x)
+{
+  const double scaled = x * (double) (1 << FIXED_FRAC);
+  const int64_t whole = (int64_t) scaled;
+  const double rest = scaled - whole;
+  return (fixed) (whole + (rest >= 0.5) - (rest <= -0.5));
+}
+
+static double from_fixed(fixed x)
+{
+  return x * (1.0 / (1 << FIXED_FRAC));
+}
+
+#ifdef ITERBATCH_AVX2
+#if ITERBATCH_LANES != 8
+#error "The AVX2 fixed-point lanes are written for eight lanes"
+#endif
+
+/*
+  The compiler won't vectorize 32x32->64 bit multiplies on its own, so
+  with AVX2 the fixed-point lanes are done by hand, all eight in one
+  register. A multiply only gives the products of the even lanes, so
+  every step does the even lanes, then the odd ones shifted down into
+  their places, and stitches the results back together. Counts are the
+  same as the plain C below, bit for bit.
+
+  Orbits stay within +-10 or so before they escape (coordinates are
+  within FIXED_MAX_COORD), so rr + ii is well inside 63 bits, and
+  adding below_sign carries it into the sign bit exactly when it
+  passes FIXED_ESCAPE.
+*/
+__attribute__((target("avx2")))
+static void iterate_fixed_lanes_avx2(fixed * zr, fixed * zi,
+                                     const fixed * cr, const fixed * ci,
+                                     unsigned * iters, int n,
+                                     unsigned start, unsigned maxiters)
+{
+  const __m256i below_sign = _mm256_set1_epi64x(INT64_MAX - FIXED_ESCAPE);
+  const __m256i cr8 = _mm256_loadu_si256((const __m256i *) cr);
+  const __m256i ci8 = _mm256_loadu_si256((const __m256i *) ci);
+  __m256i zr8 = _mm256_loadu_si256((const __m256i *) zr);
+  __m256i zi8 = _mm256_loadu_si256((const __m256i *) zi);
+  __m256i it8 = _mm256_setzero_si256();
+  // Lanes past n start out done
+  __m256i done = _mm256_cmpgt_epi32(_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0),
+                                    _mm256_set1_epi32(n - 1));
+
+  unsigned k;
+  for (k=start+1; k<maxiters; k++)
+    {
+      const __m256i zr_odd = _mm256_srli_epi64(zr8, 32);
+      const __m256i zi_odd = _mm256_srli_epi64(zi8, 32);
+      __m256i rr = _mm256_mul_epi32(zr8, zr8);
+      __m256i ii = _mm256_mul_epi32(zi8, zi8);
+      __m256i ri = _mm256_mul_epi32(zr8, zi8);
+      __m256i rr_odd = _mm256_mul_epi32(zr_odd, zr_odd);
+      __m256i ii_odd = _mm256_mul_epi32(zi_odd, zi_odd);
+      __m256i ri_odd = _mm256_mul_epi32(zr_odd, zi_odd);
+
+      // Verdicts are in the high halves' signs; move the even ones down
+      __m256i over = _mm256_add_epi64(_mm256_add_epi64(rr, ii), below_sign);
+      __m256i over_odd =
+        _mm256_add_epi64(_mm256_add_epi64(rr_odd, ii_odd), below_sign);
+      __m256i escaped =
+        _mm256_blend_epi32(_mm256_srli_epi64(_mm256_srai_epi32(over, 31), 32),
+                           _mm256_srai_epi32(over_odd, 31), 0xaa);
+
+      // Bits FIXED_FRAC up of each product, odd ones shifted into place
+      __m256i nzr =
+        _mm256_blend_epi32(_mm256_srli_epi64(_mm256_sub_epi64(rr, ii),
+                                             FIXED_FRAC),
+                           _mm256_slli_epi64(_mm256_sub_epi64(rr_odd, ii_odd),
+                                             32 - FIXED_FRAC), 0xaa);
+      __m256i nzi =
+        _mm256_blend_epi32(_mm256_srli_epi64(ri, FIXED_FRAC - 1),
+                           _mm256_slli_epi64(ri_odd, 33 - FIXED_FRAC), 0xaa);
+      nzr = _mm256_add_epi32(nzr, cr8);
+      nzi = _mm256_add_epi32(nzi, ci8);
+
+      __m256i newly = _mm256_andnot_si256(done, escaped);
+      it8 = _mm256_blendv_epi8(it8, _mm256_set1_epi32(k), newly);
+      done = _mm256_or_si256(done, escaped);
+      zr8 = _mm256_blendv_epi8(nzr, zr8, done);
+      zi8 = _mm256_blendv_epi8(nzi, zi8, done);
+      if (_mm256_movemask_epi8(done) == -1)
+        break;
+    }
+
+  // Whoever is still going ran out of budget
+  it8 = _mm256_blendv_epi8(_mm256_set1_epi32(maxiters), it8, done);
+  _mm256_storeu_si256((__m256i *) zr, zr8);
+  _mm256_storeu_si256((__m256i *) zi, zi8);
+  _mm256_storeu_si256((__m256i *) iters, it8);
+}
+
+#endif
+
+// Same shape as iterate_double_lanes
+static void iterate_fixed_lanes(fixed * zr, fixed * zi,
+                                const fixed * cr, const fixed * ci,
+                                unsigned * iters, int n,
+                                unsigned start, unsigned maxiters)
+{
+  unsigned char done[ITERBATCH_LANES];
+  int l;
+  for (l=0; l<ITERBATCH_LANES; l++)
+    done[l] = l >= n;
+
+  unsigned k;
+  for (k=start+1; k<maxiters; k++)
+    {
+      int alive = 0;
+      for (l=0; l<ITERBATCH_LANES; l++)
+        {
+          int64_t rr = (int64_t) zr[l] * zr[l];
+          int64_t ii = (int64_t) zi[l] * zi[l];
+          int64_t ri = (int64_t) zr[l] * zi[l];
+          int escaped = rr + ii > FIXED_ESCAPE;
+          iters[l] = escaped && !done[l] ? k : iters[l];
+          done[l] |= escaped;
+          fixed nzr = (fixed) ((rr - ii) >> FIXED_FRAC) + cr[l];
+          fixed nzi = (fixed) (ri >> (FIXED_FRAC - 1)) + ci[l];
+          zr[l] = done[l] ? zr[l] : nzr;
+          zi[l] = done[l] ? zi[l] : nzi;
+          alive += !done[l];
+        }
+      if (!alive) return;
+    }
+
+  for (l=0; l<n; l++)
+    if (!done[l])
+      iters[l] = maxiters;
+}
+
+void iterate_batch_fixed(size_t n, const double * cr, const double * ci,
+                         double * zr, double * zi,
+                         unsigned start, unsigned maxiters,
+                         unsigned * iters, float * smooth)
+{
+  fixed lzr[ITERBATCH_LANES], lzi[ITERBATCH_LANES];
+  fixed lcr[ITERBATCH_LANES], lci[ITERBATCH_LANES];
+  unsigned liters[ITERBATCH_LANES];
+#ifdef ITERBATCH_AVX2
+  const int avx2 = iterbatch_simd();
+#endif
+
+  size_t base;
+  for (base=0; base<n; base+=ITERBATCH_LANES)
+    {
+      int m = n - base < ITERBATCH_LANES ? n - base : ITERBATCH_LANES;
+      int l;
+      for (l=0; l<ITERBATCH_LANES; l++)
+        {
+          lzr[l] = l < m ? to_fixed(zr[base + l]) : 0;
+          lzi[l] = l < m ? to_fixed(zi[base + l]) : 0;
+          lcr[l] = l < m ? to_fixed(cr[base + l]) : 0;
+          lci[l] = l < m ? to_fixed(ci[base + l]) : 0;
+        }
+
+#ifdef ITERBATCH_AVX2
+      if (avx2)
+        iterate_fixed_lanes_avx2(lzr, lzi, lcr, lci, liters, m,
+                                 start, maxiters);
+      else
+#endif
+        iterate_fixed_lanes(lzr, lzi, lcr, lci, liters, m, start, maxiters);
+
+      for (l=0; l<m; l++)
+        {
+          zr[base + l] = from_fixed(lzr[l]);
+          zi[base + l] = from_fixed(lzi[l]);
+          iters[base + l] = liters[l];
+        }
+    }
+
+  if (smooth)
+    smooth_counts(n, zr, zi, iters, maxiters, smooth);
+}
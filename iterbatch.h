@@ -0,0 +1,75 @@
+#ifndef __ITERBATCH_H
+#define __ITERBATCH_H
+
+#include <stddef.h>
+#include "complex.h"
+
+/*
+  The escape-time kernels every renderer here runs on, with no notion
+  of pixels, panels or SDL. A batch is a structure of arrays: the real
+  and imaginary parts of c and z each in their own array, so the inner
+  loops run across points and the compiler can vectorize them. All
+  output goes into arrays the caller owns.
+
+  Every point in a batch starts at the same count, start, from the z
+  in zr/zi, and counts the way iterate_resume does. On return iters
+  holds each point's count and zr/zi its last z: where it escaped, or
+  the state to resume from (with start = maxiters - 1) if it reached
+  maxiters. If smooth isn't NULL it gets the fractional escape count
+  of each point, maxiters for those that didn't escape.
+*/
+
+// Points run in lockstep this many at a time
+#define ITERBATCH_LANES (8)
+
+/*
+  Fixed-point arithmetic for iterate_batch_fixed: Q4.27 in 32 bits,
+  with 64 bit products. Integer math gives the same counts on every
+  machine, and 32 bit lanes pack twice as many to a vector register as
+  doubles. Coordinates must be within +-FIXED_MAX_COORD so orbits
+  can't overflow before they escape, and a resumed z must be one this
+  kernel returned (those are exact in a double).
+
+  gcc won't vectorize the 64 bit products itself, so the fixed-point
+  lanes come in two versions: plain C that leans on instruction-level
+  parallelism, and hand-written AVX2 lanes with the same counts.
+*/
+#define FIXED_FRAC (27)
+#define FIXED_MAX_COORD (4.0)
+
+/*
+  The hand-written AVX2 code (the fixed-point lanes here, and the
+  gathering colorizer in iterbuf.c) is built into every x86 binary
+  whatever the -m flags, and runs when the CPU turns out to have AVX2.
+  -DITERBATCH_NO_SIMD leaves it out altogether.
+*/
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+  !defined(ITERBATCH_NO_SIMD)
+#define ITERBATCH_AVX2
+#endif
+
+/* Whether the AVX2 code runs */
+int iterbatch_simd(void);
+/* Turns the AVX2 code off (or back on, where the CPU has it), so it
+   can be held to the plain C. Returns whether it runs now. */
+int iterbatch_set_simd(int on);
+
+void iterate_batch(size_t n, const double * cr, const double * ci,
+                   double * zr, double * zi,
+                   unsigned start, unsigned maxiters,
+                   unsigned * iters, float * smooth);
+void iterate_batch_fixed(size_t n, const double * cr, const double * ci,
+                         double * zr, double * zi,
+                         unsigned start, unsigned maxiters,
+                         unsigned * iters, float * smooth);
+
+/*
+  z -> z*z + c, picking up at iteration count iters. Starting from
+  iters = 0 this matches a fresh escape-time iteration; an orbit that
+  ran out at budget m continues exactly with iters = m - 1. This is the
+  reference the batch kernels are held to.
+*/
+unsigned iterate_resume(complex * z, const complex c,
+                        unsigned iters, unsigned maxiters);
+
+#endif
@@ -0,0 +1,634 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "iterbuf.h"
+
+// Picked at run time, like the fixed-point lanes (see iterbatch.h)
+#ifdef ITERBATCH_AVX2
+#include <immintrin.h>
+#endif
+
+// Drops a mapping, leaving the buffer ready for the heap
+static void iterbuf_unmap(iterbuf * buf)
+{
+  if (buf->mapping == NULL) return;
+  munmap(buf->mapping, buf->mapping_size);
+  buf->mapping = NULL;
+  buf->mapping_size = 0;
+  buf->iters = NULL;
+  buf->z = NULL;
+}
+
+// Pixels of storage, with both sides padded out to whole blocks
+static size_t iterbuf_padded(int w, int h)
+{
+  const size_t bw = (w + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK;
+  const size_t bh = (h + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK;
+  return bw * bh * ITERBUF_BLOCK * ITERBUF_BLOCK;
+}
+
+static size_t iterbuf_z_offset(int w, int h)
+{
+  return (sizeof(unsigned) * iterbuf_padded(w, h) + ITERBUF_ALIGN - 1)
+    & ~(size_t) (ITERBUF_ALIGN - 1);
+}
+
+size_t iterbuf_mapping_size(int w, int h)
+{
+  return iterbuf_z_offset(w, h) + sizeof(complex) * iterbuf_padded(w, h);
+}
+
+/*
+  Maps size bytes of zeroes on a huge page boundary, rounded up to
+  whole huge pages, and asks for them to be backed by huge pages: a
+  full-window buffer then takes a handful of TLB entries, not
+  thousands. Where there are no transparent huge pages it's just an
+  aligned mapping.
+*/
+static void * map_huge(size_t size, size_t * mapped)
+{
+  const size_t huge = ITERBUF_HUGE_BYTES;
+  const size_t want = (size + huge - 1) & ~(huge - 1);
+  char * map = mmap(NULL, want + huge, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) return NULL;
+
+  // Trim the slack off both ends so what's left starts on a boundary
+  char * start = (char *) (((uintptr_t) map + huge - 1) & ~(uintptr_t) (huge - 1));
+  if (start > map)
+    munmap(map, start - map);
+  if (start + want < map + want + huge)
+    munmap(start + want, map + want + huge - (start + want));
+
+#ifdef MADV_HUGEPAGE
+  madvise(start, want, MADV_HUGEPAGE);
+#endif
+  *mapped = want;
+  return start;
+}
+
+int iterbuf_alloc(iterbuf * buf, int w, int h)
+{
+  const size_t size = iterbuf_mapping_size(w, h);
+  void * block;
+
+  iterbuf_free(buf);
+  if (size >= ITERBUF_HUGE_BYTES)
+    {
+      block = map_huge(size, &buf->mapping_size);
+      if (block == NULL) return -1;
+      buf->mapping = block;
+    }
+  else
+    {
+      // Small enough for the heap; blocks still start on cache lines
+      if (posix_memalign(&block, ITERBUF_ALIGN, size)) return -1;
+      memset(block, 0, size);
+    }
+  buf->iters = block;
+  buf->z = (complex *) ((char *) block + iterbuf_z_offset(w, h));
+
+  buf->w = w;
+  buf->h = h;
+  iterbuf_set_window(buf, 0, 0, w, h);
+  buf->maxiters = 0;
+  buf->unresolved = 0;
+  return 0;
+}
+
+void iterbuf_free(iterbuf * buf)
+{
+  if (buf->mapping)
+    iterbuf_unmap(buf);
+  else
+    {
+      // z lives in the same block as iters
+      free(buf->iters);
+      buf->iters = NULL;
+      buf->z = NULL;
+    }
+  buf->w = buf->h = 0;
+}
+
+void iterbuf_map(iterbuf * buf, void * mapping, int w, int h)
+{
+  iterbuf_free(buf);
+  buf->mapping = mapping;
+  buf->mapping_size = iterbuf_mapping_size(w, h);
+  buf->iters = mapping;
+  buf->z = (complex *) ((char *) mapping + iterbuf_z_offset(w, h));
+  buf->w = w;
+  buf->h = h;
+  iterbuf_set_window(buf, 0, 0, w, h);
+  buf->maxiters = 0;
+  buf->unresolved = 0;
+}
+
+void iterbuf_set_window(iterbuf * buf, int x0, int y0,
+                        int full_w, int full_h)
+{
+  buf->x0 = x0;
+  buf->y0 = y0;
+  buf->full_w = full_w;
+  buf->full_h = full_h;
+}
+
+void iterbuf_key_fill(iterbuf_key * key, iterbuf_kind kind,
+                      iterbuf_kernel kernel,
+                      complex_region region, complex c,
+                      int w, int h, unsigned start_maxiters)
+{
+  memset(key, 0, sizeof *key);
+  key->kind = kind;
+  key->kernel = kernel;
+  key->w = w;
+  key->h = h;
+  key->start_maxiters = start_maxiters;
+  key->region = region;
+  // c means nothing for the Mandelbrot, so don't let it split entries
+  if (kind == ITERBUF_JULIA)
+    key->c = c;
+}
+
+// Bitwise on the doubles: -0.0 and 0.0 are different views as far as
+// the hash is concerned, so they had better be here too
+int iterbuf_key_equal(const iterbuf_key * a, const iterbuf_key * b)
+{
+  return a->kind == b->kind && a->kernel == b->kernel &&
+    a->w == b->w && a->h == b->h &&
+    a->start_maxiters == b->start_maxiters &&
+    !memcmp(&a->region.topleft, &b->region.topleft, sizeof(complex)) &&
+    !memcmp(&a->region.bottomright, &b->region.bottomright, sizeof(complex)) &&
+    !memcmp(&a->c, &b->c, sizeof(complex));
+}
+
+// The point a pixel samples, computed the same way the draw loops do
+static complex pixel_point(const iterbuf * buf, int i, int j)
+{
+  complex p;
+  p.r = buf->region.topleft.r +
+    (buf->region.bottomright.r - buf->region.topleft.r)
+    * (buf->x0 + i) / buf->full_w;
+  p.i = buf->region.topleft.i +
+    (buf->region.bottomright.i - buf->region.topleft.i)
+    * (buf->y0 + j) / buf->full_h;
+  return p;
+}
+
+int iterbuf_fixed_permitted(const iterbuf * buf)
+{
+  const double limit = FIXED_MAX_COORD;
+  const double spacing = ldexp(1.0, -FIXED_MIN_SPACING_BITS);
+  const complex_region * r = &buf->region;
+
+  if (fabs(r->bottomright.r - r->topleft.r) / buf->full_w < spacing ||
+      fabs(r->bottomright.i - r->topleft.i) / buf->full_h < spacing)
+    return 0;
+  if (fabs(r->topleft.r) > limit || fabs(r->topleft.i) > limit ||
+      fabs(r->bottomright.r) > limit || fabs(r->bottomright.i) > limit)
+    return 0;
+  if (buf->kind == ITERBUF_JULIA &&
+      (fabs(buf->c.r) > limit || fabs(buf->c.i) > limit))
+    return 0;
+  return 1;
+}
+
+/*
+  Runs pixels through the batch kernels ITERBUF_BATCH at a time. From
+  start 0 that is every pixel, from scratch; otherwise only the ones
+  still unresolved at start + 1, picking up their orbits where they
+  stopped. Pixels go in storage order, a block at a time, so gathers
+  and scatters walk memory straight through. Only blocks bx0..bx1-1
+  across and by0..by1-1 down are done, and the unresolved ones among
+  them are added to buf->unresolved.
+*/
+static void iterate_blocks(iterbuf * buf, unsigned start,
+                           int bx0, int by0, int bx1, int by1)
+{
+  double cr[ITERBUF_BATCH], ci[ITERBUF_BATCH];
+  double zr[ITERBUF_BATCH], zi[ITERBUF_BATCH];
+  unsigned iters[ITERBUF_BATCH];
+  size_t index[ITERBUF_BATCH];
+  const int blocks_across = (buf->w + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK;
+  const int area = ITERBUF_BLOCK * ITERBUF_BLOCK;
+
+  int bx = bx0, by = by0, within = 0;
+  while (by < by1)
+    {
+      // Gather
+      int n = 0, l;
+      while (n < ITERBUF_BATCH && by < by1)
+        {
+          const size_t k = ((size_t) by * blocks_across + bx) * area + within;
+          const int x = bx * ITERBUF_BLOCK + within % ITERBUF_BLOCK;
+          const int y = by * ITERBUF_BLOCK + within / ITERBUF_BLOCK;
+          if (++within == area)
+            {
+              within = 0;
+              if (++bx == bx1)
+                {
+                  bx = bx0;
+                  by++;
+                }
+            }
+          // Padding
+          if (x >= buf->w || y >= buf->h) continue;
+          if (start > 0 && buf->iters[k] <= start) continue;
+          complex p = pixel_point(buf, x, y);
+          index[n] = k;
+          if (start > 0)
+            {
+              zr[n] = buf->z[k].r;
+              zi[n] = buf->z[k].i;
+            }
+          else if (buf->kind == ITERBUF_JULIA)
+            {
+              zr[n] = p.r;
+              zi[n] = p.i;
+            }
+          else
+            zr[n] = zi[n] = 0;
+          cr[n] = buf->kind == ITERBUF_JULIA ? buf->c.r : p.r;
+          ci[n] = buf->kind == ITERBUF_JULIA ? buf->c.i : p.i;
+          n++;
+        }
+
+      if (buf->fixed)
+        iterate_batch_fixed(n, cr, ci, zr, zi, start, buf->maxiters,
+                            iters, NULL);
+      else
+        iterate_batch(n, cr, ci, zr, zi, start, buf->maxiters, iters, NULL);
+
+      // Scatter
+      for (l=0; l<n; l++)
+        {
+          buf->iters[index[l]] = iters[l];
+          if (iters[l] >= buf->maxiters)
+            {
+              buf->z[index[l]].r = zr[l];
+              buf->z[index[l]].i = zi[l];
+              buf->unresolved++;
+            }
+        }
+    }
+}
+
+static void iterate_pixels(iterbuf * buf, unsigned start)
+{
+  buf->unresolved = 0;
+  iterate_blocks(buf, start, 0, 0,
+                 (buf->w + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK,
+                 (buf->h + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK);
+}
+
+void iterbuf_spot_check(const iterbuf * buf,
+                        unsigned * checked, unsigned * mismatched)
+{
+  const unsigned total = buf->w * buf->h;
+  unsigned k;
+  for (k=0; k<total; k+=FIXED_CHECK_STRIDE)
+    {
+      const int x = k % buf->w, y = k / buf->w;
+      complex p = pixel_point(buf, x, y);
+      complex z = {0,0}, c = buf->c;
+      if (buf->kind == ITERBUF_JULIA)
+        z = p;
+      else
+        c = p;
+      (*checked)++;
+      if (iterate_resume(&z, c, 0, buf->maxiters) !=
+          buf->iters[iterbuf_index(buf, x, y)])
+        (*mismatched)++;
+    }
+}
+
+// Whether a fixed render is close enough to what double would give
+static int fixed_agrees(const iterbuf * buf)
+{
+  unsigned checked = 0, mismatched = 0;
+  iterbuf_spot_check(buf, &checked, &mismatched);
+  return mismatched * 100 <= checked * FIXED_MAX_MISMATCH_PCT;
+}
+
+// Takes on the view and settles the kernel for a render from scratch
+static void begin_render(iterbuf * buf, iterbuf_kind kind,
+                         complex_region region, complex c,
+                         unsigned maxiters)
+{
+  buf->kind = kind;
+  buf->region = region;
+  buf->c = c;
+  buf->maxiters = maxiters;
+
+  buf->fixed = buf->kernel == ITERBUF_KERNEL_FIXED ||
+    (buf->kernel == ITERBUF_KERNEL_AUTO && iterbatch_simd() &&
+     iterbuf_fixed_permitted(buf));
+}
+
+void iterbuf_render(iterbuf * buf, iterbuf_kind kind,
+                    complex_region region, complex c,
+                    unsigned maxiters)
+{
+  begin_render(buf, kind, region, c, maxiters);
+  iterate_pixels(buf, 0);
+  // Asked for fixed point outright means fixed point, right or wrong
+  if (buf->fixed && buf->kernel == ITERBUF_KERNEL_AUTO && !fixed_agrees(buf))
+    {
+      buf->fixed = 0;
+      iterate_pixels(buf, 0);
+    }
+}
+
+/*** Focused rendering ***/
+
+typedef struct
+{
+  int bx0, by0, bx1, by1; // blocks covered, as for iterate_blocks
+  unsigned ring;          // tiles from the focus's tile, rounded
+  double cost;            // iterations it's expected to take
+}
+focus_tile;
+
+// Nearest first; among equals, cheapest first, so more shows sooner
+static int by_focus(const void * a, const void * b)
+{
+  const focus_tile * ta = a, * tb = b;
+  if (ta->ring != tb->ring) return ta->ring < tb->ring ? -1 : 1;
+  return ta->cost < tb->cost ? -1 : ta->cost > tb->cost;
+}
+
+// Iterations a tile will take, going by a sparse grid of its orbits
+static double estimate_cost(const iterbuf * buf, int x, int y, int w, int h)
+{
+  const int n = ITERBUF_FOCUS_SAMPLES;
+  double cost = 0;
+  int i,j;
+  for (j=0; j<n; j++)
+    for (i=0; i<n; i++)
+      {
+        complex p = pixel_point(buf, x + (2 * i + 1) * w / (2 * n),
+                                y + (2 * j + 1) * h / (2 * n));
+        complex z = {0,0}, c = buf->c;
+        if (buf->kind == ITERBUF_JULIA)
+          z = p;
+        else
+          c = p;
+        cost += iterate_resume(&z, c, 0, buf->maxiters);
+      }
+  return cost;
+}
+
+// Tiles in the order a focused render takes them, or NULL
+static focus_tile * plan_focus(const iterbuf * buf, int fx, int fy,
+                               int * ntiles)
+{
+  const int side = ITERBUF_FOCUS_TILE / ITERBUF_BLOCK;
+  const int blocks_across = (buf->w + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK;
+  const int blocks_down = (buf->h + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK;
+  const int across = (blocks_across + side - 1) / side;
+  const int down = (blocks_down + side - 1) / side;
+
+  focus_tile * tiles = malloc(sizeof(focus_tile) * across * down);
+  if (tiles == NULL) return NULL;
+  int i,j;
+  for (j=0; j<down; j++)
+    for (i=0; i<across; i++)
+      {
+        focus_tile * t = &tiles[j * across + i];
+        t->bx0 = i * side;
+        t->by0 = j * side;
+        t->bx1 = t->bx0 + side < blocks_across ? t->bx0 + side : blocks_across;
+        t->by1 = t->by0 + side < blocks_down ? t->by0 + side : blocks_down;
+
+        const int x = t->bx0 * ITERBUF_BLOCK, y = t->by0 * ITERBUF_BLOCK;
+        int w = t->bx1 * ITERBUF_BLOCK - x, h = t->by1 * ITERBUF_BLOCK - y;
+        if (x + w > buf->w) w = buf->w - x;
+        if (y + h > buf->h) h = buf->h - y;
+        // Rings of tiles round the one the focus is on, which is ring 0
+        t->ring = lround(hypot(i - fx / ITERBUF_FOCUS_TILE,
+                               j - fy / ITERBUF_FOCUS_TILE));
+        t->cost = estimate_cost(buf, x, y, w, h);
+      }
+  qsort(tiles, across * down, sizeof(focus_tile), by_focus);
+  *ntiles = across * down;
+  return tiles;
+}
+
+// From start as iterate_blocks, a tile at a time
+static void iterate_focused(iterbuf * buf, const focus_tile * tiles,
+                            int ntiles, unsigned start,
+                            iterbuf_progress done, void * arg)
+{
+  int t;
+  buf->unresolved = 0;
+  for (t=0; t<ntiles; t++)
+    {
+      const focus_tile * tile = &tiles[t];
+      const int x = tile->bx0 * ITERBUF_BLOCK, y = tile->by0 * ITERBUF_BLOCK;
+      int w = tile->bx1 * ITERBUF_BLOCK - x, h = tile->by1 * ITERBUF_BLOCK - y;
+      if (x + w > buf->w) w = buf->w - x;
+      if (y + h > buf->h) h = buf->h - y;
+      iterate_blocks(buf, start, tile->bx0, tile->by0, tile->bx1, tile->by1);
+      if (done) done(buf, x, y, w, h, arg);
+    }
+}
+
+void iterbuf_render_focused(iterbuf * buf, iterbuf_kind kind,
+                            complex_region region, complex c,
+                            unsigned maxiters, int fx, int fy,
+                            iterbuf_progress done, void * arg)
+{
+  begin_render(buf, kind, region, c, maxiters);
+  int ntiles;
+  focus_tile * tiles = plan_focus(buf, fx, fy, &ntiles);
+  if (tiles == NULL)
+    {
+      // Can't schedule, but can still render
+      iterbuf_render(buf, kind, region, c, maxiters);
+      if (done) done(buf, 0, 0, buf->w, buf->h, arg);
+      return;
+    }
+
+  iterate_focused(buf, tiles, ntiles, 0, done, arg);
+  // As iterbuf_render, except the redo goes up tile by tile as well
+  if (buf->fixed && buf->kernel == ITERBUF_KERNEL_AUTO && !fixed_agrees(buf))
+    {
+      buf->fixed = 0;
+      iterate_focused(buf, tiles, ntiles, 0, done, arg);
+    }
+  free(tiles);
+}
+
+void iterbuf_extend(iterbuf * buf, unsigned maxiters)
+{
+  const unsigned oldmax = buf->maxiters;
+  if (maxiters <= oldmax || oldmax == 0) return;
+
+  buf->maxiters = maxiters;
+  iterate_pixels(buf, oldmax - 1);
+}
+
+void iterbuf_refine(iterbuf * buf, double base_span,
+                    iterbuf_progress step, void * arg)
+{
+  unsigned next;
+  while ((next = iterbuf_suggest_maxiters(buf, base_span)) > buf->maxiters)
+    {
+      iterbuf_extend(buf, next);
+      if (step) step(buf, 0, 0, buf->w, buf->h, arg);
+    }
+}
+
+void iterbuf_refine_focused(iterbuf * buf, double base_span, int fx, int fy,
+                            iterbuf_progress done, void * arg)
+{
+  if (buf->maxiters == 0) return;
+  int ntiles;
+  focus_tile * tiles = plan_focus(buf, fx, fy, &ntiles);
+  if (tiles == NULL)
+    {
+      iterbuf_refine(buf, base_span, done, arg);
+      return;
+    }
+
+  unsigned next;
+  while ((next = iterbuf_suggest_maxiters(buf, base_span)) > buf->maxiters)
+    {
+      const unsigned oldmax = buf->maxiters;
+      buf->maxiters = next;
+      iterate_focused(buf, tiles, ntiles, oldmax - 1, done, arg);
+    }
+  free(tiles);
+}
+
+unsigned iterbuf_suggest_maxiters(const iterbuf * buf, double base_span)
+{
+  const unsigned maxiters = buf->maxiters;
+  const unsigned total = buf->w * buf->h;
+  if (total == 0 || maxiters == 0) return MAXITERS_MIN;
+
+  // Deeper zooms need a longer budget no matter what the histogram says
+  double floor = MAXITERS_MIN;
+  double span = fabs(buf->region.bottomright.r - buf->region.topleft.r);
+  if (span > 0 && span < base_span)
+    floor += MAXITERS_PER_OCTAVE * log2(base_span / span);
+
+  // Walk the escape histogram: how many pixels escaped in the last
+  // quarter of the budget, and how late the slowest escaper was
+  // (Padding counts as escaping at once, which changes neither.)
+  const unsigned late_mark = maxiters - maxiters / 4;
+  const size_t padded = iterbuf_padded(buf->w, buf->h);
+  unsigned late = 0, slowest = 0;
+  size_t k;
+  for (k=0; k<padded; k++)
+    {
+      unsigned iters = buf->iters[k];
+      if (iters >= maxiters) continue;
+      if (iters > slowest) slowest = iters;
+      if (iters >= late_mark) late++;
+    }
+
+  unsigned next = maxiters;
+  /* The escape tail runs into the budget, so there is boundary detail
+     being painted as interior. Only chase it while it is a meaningful
+     share of the unresolved pixels, since extending costs one budget
+     per unresolved pixel. */
+  if (buf->unresolved && (unsigned long long) late * 1000 > total &&
+      (unsigned long long) late * 64 > buf->unresolved)
+    next = maxiters * 2;
+  // Nothing escapes late; the back half of the budget is spent on interior
+  else if (slowest < maxiters / 2)
+    next = slowest * 2;
+
+  if (next < floor) next = (unsigned) floor;
+  if (next < MAXITERS_MIN) next = MAXITERS_MIN;
+  if (next > MAXITERS_CAP) next = MAXITERS_CAP;
+  return next;
+}
+
+void iterbuf_colorize(const iterbuf * buf, const uint32_t * colormap,
+                      uint32_t inside, uint32_t * pixels, int pitch)
+{
+  iterbuf_colorize_rect(buf, 0, 0, buf->w, buf->h, colormap, inside,
+                        pixels, pitch);
+}
+
+void iterbuf_counts(const iterbuf * buf, unsigned * out)
+{
+  int i,j;
+  for (j=0; j<buf->h; j++)
+    for (i=0; i<buf->w; i++)
+      *out++ = buf->iters[iterbuf_index(buf, i, j)];
+}
+
+/*
+  Colors one full block row, ITERBUF_BLOCK counts, in two rounds of
+  eight lanes: vpgatherdd looks the colors up, with the index held to
+  maxiters - 1 so unresolved lanes stay inside the colormap, and a
+  compare and blend puts the inside color over those. The pixels are
+  the plain C loop's, exactly.
+*/
+#ifdef ITERBATCH_AVX2
+__attribute__((target("avx2")))
+static void colorize_block_row_avx2(const unsigned * in, uint32_t * out,
+                                    const uint32_t * colormap,
+                                    unsigned maxiters, uint32_t inside)
+{
+#if ITERBUF_BLOCK % 8
+#error "The AVX2 colorizer is written for blocks of whole vectors"
+#endif
+  // Counts never reach 2^31, so signed compares are safe
+  const __m256i limit = _mm256_set1_epi32(maxiters);
+  const __m256i top = _mm256_set1_epi32(maxiters - 1);
+  const __m256i inside_v = _mm256_set1_epi32(inside);
+  int n;
+  for (n=0; n<ITERBUF_BLOCK; n+=8)
+    {
+      const __m256i iters = _mm256_loadu_si256((const __m256i *) (in + n));
+      const __m256i escaped = _mm256_cmpgt_epi32(limit, iters);
+      const __m256i index = _mm256_min_epu32(iters, top);
+      const __m256i color =
+        _mm256_i32gather_epi32((const int *) colormap, index, 4);
+      _mm256_storeu_si256((__m256i *) (out + n),
+                          _mm256_blendv_epi8(inside_v, color, escaped));
+    }
+}
+#endif
+
+/*
+  Detiles as it colors: each output row is written straight through,
+  a block row (one cache line of counts) at a time. Full block rows go
+  to colorize_block_row_avx2 where it runs; everything else is done a
+  pixel at a time.
+*/
+void iterbuf_colorize_rect(const iterbuf * buf, int x, int y, int w, int h,
+                           const uint32_t * colormap, uint32_t inside,
+                           uint32_t * pixels, int pitch)
+{
+  const unsigned maxiters = buf->maxiters;
+#ifdef ITERBATCH_AVX2
+  const int avx2 = iterbatch_simd() && maxiters > 0;
+#endif
+  int i,j,n;
+  for (j=0; j<h; j++)
+    {
+      uint32_t * out = pixels + (size_t) j * pitch;
+      for (i=0; i<w; i+=n)
+        {
+          const unsigned * in = buf->iters + iterbuf_index(buf, x + i, y + j);
+          const int left = ITERBUF_BLOCK - (x + i) % ITERBUF_BLOCK;
+#ifdef ITERBATCH_AVX2
+          if (avx2 && left == ITERBUF_BLOCK && w - i >= ITERBUF_BLOCK)
+            {
+              colorize_block_row_avx2(in, out + i, colormap, maxiters, inside);
+              n = ITERBUF_BLOCK;
+              continue;
+            }
+#endif
+          const int run = left < w - i ? left : w - i;
+          for (n=0; n<run; n++)
+            out[i + n] = in[n] >= maxiters ? inside : colormap[in[n]];
+        }
+    }
+}
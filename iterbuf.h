@@ -0,0 +1,222 @@
+#ifndef __ITERBUF_H
+#define __ITERBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "complex.h"
+#include "iterbatch.h"
+
+/* Which fractal a buffer holds */
+typedef enum
+{
+  ITERBUF_MANDELBROT,
+  ITERBUF_JULIA
+}
+iterbuf_kind;
+
+/*
+  Which arithmetic iterbuf_render uses. AUTO is the default (a zeroed
+  buffer has it), and only goes to fixed point where that wins: the
+  view allows it and the AVX2 lanes run (see iterbatch.h). Plain C
+  fixed point is slower than the lockstep double kernel.
+*/
+typedef enum
+{
+  ITERBUF_KERNEL_AUTO,    // fixed point when the view and CPU allow it
+  ITERBUF_KERNEL_DOUBLE,
+  ITERBUF_KERNEL_FIXED
+}
+iterbuf_kernel;
+
+/*
+  Per-pixel iteration counts for one panel, plus enough orbit state to
+  keep going on the pixels that have not escaped yet. A pixel whose
+  count equals maxiters is "unresolved": its z is the orbit as it stood
+  when the budget ran out.
+
+  iters and z are not row-major: they are stored in ITERBUF_BLOCK
+  square blocks, the blocks in rows, each block row-major inside (see
+  iterbuf_index). One block row of counts is one cache line, so a pixel
+  and its neighbours above and below are a few lines apart instead of
+  a few pages, whatever the window width. The buffer is padded out to
+  whole blocks; padding pixels stay zero and are never iterated.
+*/
+typedef struct
+{
+  int w, h;
+  iterbuf_kind kind;
+  complex_region region;
+  complex c;             // Julia parameter; unused for the Mandelbrot
+  unsigned maxiters;     // budget every pixel has been iterated to
+  unsigned unresolved;   // number of pixels still at maxiters
+  unsigned * iters;
+  complex * z;
+  // Where this buffer sits in the whole image, if it is only a tile
+  // of it; a fresh buffer is the whole image
+  int x0, y0;
+  int full_w, full_h;
+  // Kernel to render with, and whether the last render ended up in
+  // fixed point (extending then stays in fixed point)
+  iterbuf_kernel kernel;
+  int fixed;
+  // Set when iters and z live in a mapping (see iterbuf_map) rather
+  // than on the heap
+  void * mapping;
+  size_t mapping_size;
+}
+iterbuf;
+
+/*
+  Everything a render from scratch depends on, so the caches
+  (itercache, juliaserver) file buffers under it. The adaptive budget
+  is a pure function of the key, and with a kernel of DOUBLE or FIXED
+  so is every count, so equal keys give equal buffers (though a cached
+  one may have been extended past where a fresh render would stop).
+  AUTO's pick also depends on the CPU, so its buffers carry their
+  fixed flag for anyone who needs to know.
+*/
+typedef struct
+{
+  unsigned kind;
+  unsigned kernel;         // as asked for, not as it turned out
+  int w, h;
+  unsigned start_maxiters;
+  complex_region region;
+  complex c;               // zero for the Mandelbrot
+}
+iterbuf_key;
+
+/* The regions every tool starts from, as complex_region initializers,
+   and their widths, for judging zoom depth */
+#define MANDELBROT_DEFAULT_REGION { {-2, 1.5}, {1, -1.5} }
+#define JULIA_DEFAULT_REGION { {-2, 2}, {2, -2} }
+#define MANDELBROT_BASE_SPAN (3.0)
+#define JULIA_BASE_SPAN (4.0)
+
+// Pixels handed to the batch kernels at a time
+#define ITERBUF_BATCH (256)
+
+// Side of a storage block: 16 counts are one 64 byte cache line
+#define ITERBUF_BLOCK (16)
+#define ITERBUF_ALIGN (64)
+// Focused renders go in tiles this big (a whole number of blocks),
+// each costed from a grid of this many orbits a side
+#define ITERBUF_FOCUS_TILE (64)
+#define ITERBUF_FOCUS_SAMPLES (4)
+// Buffers this big are mapped on their own and offered to huge pages
+#define ITERBUF_HUGE_BYTES ((size_t) 2 << 20)
+
+/*
+  The fixed-point kernel (see iterbatch.h) is only picked when pixels
+  are at least 2^-FIXED_MIN_SPACING_BITS apart (a thousand or so
+  fixed-point steps, so rounding stays far below a pixel) and every
+  coordinate is inside +-FIXED_MAX_COORD. Every fixed render is
+  spot-checked against the double kernel on every FIXED_CHECK_STRIDEth
+  pixel, and redone in double if more than FIXED_MAX_MISMATCH_PCT
+  percent disagree.
+*/
+#define FIXED_MIN_SPACING_BITS (17)
+#define FIXED_CHECK_STRIDE (61)
+#define FIXED_MAX_MISMATCH_PCT (1)
+
+/* Iteration budget bounds for the adaptive controller */
+#define MAXITERS_MIN (64)
+#define MAXITERS_CAP (1 << 16)
+#define MAXITERS_PER_OCTAVE (48)
+
+/* Where pixel (x,y) lives in iters and z */
+static inline size_t iterbuf_index(const iterbuf * buf, int x, int y)
+{
+  const size_t blocks_across = (buf->w + ITERBUF_BLOCK - 1) / ITERBUF_BLOCK;
+  return ((y / ITERBUF_BLOCK) * blocks_across + x / ITERBUF_BLOCK)
+    * (ITERBUF_BLOCK * ITERBUF_BLOCK)
+    + (y % ITERBUF_BLOCK) * ITERBUF_BLOCK + x % ITERBUF_BLOCK;
+}
+
+/* Allocates (or reallocates) a w x h buffer, zeroed. Returns 0 on
+   success. The buffer must start out zeroed. */
+int iterbuf_alloc(iterbuf * buf, int w, int h);
+void iterbuf_free(iterbuf * buf);
+
+/*
+  Memory layout of a w x h buffer, on the heap and shared alike: padded
+  counts first, then padded orbits at the next ITERBUF_ALIGN boundary.
+  iterbuf_map points buf at such a mapping (which it then owns, and
+  unmaps when freed or reallocated).
+*/
+size_t iterbuf_mapping_size(int w, int h);
+void iterbuf_map(iterbuf * buf, void * mapping, int w, int h);
+
+/* Makes the buffer a w x h tile at (x0,y0) of a full_w x full_h image,
+   sampling exactly the points the whole image would there */
+void iterbuf_set_window(iterbuf * buf, int x0, int y0,
+                        int full_w, int full_h);
+
+/* Whether the fixed-point kernel is accurate enough for this view */
+int iterbuf_fixed_permitted(const iterbuf * buf);
+
+/* Fills a key, zeroing padding and anything the render ignores, so
+   keys can be compared and hashed as they stand */
+void iterbuf_key_fill(iterbuf_key * key, iterbuf_kind kind,
+                      iterbuf_kernel kernel,
+                      complex_region region, complex c,
+                      int w, int h, unsigned start_maxiters);
+int iterbuf_key_equal(const iterbuf_key * a, const iterbuf_key * b);
+
+/* Recomputes every FIXED_CHECK_STRIDEth pixel in double, adding to
+   checked, and to mismatched where the buffer's count differs, so
+   several buffers can be judged together against
+   FIXED_MAX_MISMATCH_PCT */
+void iterbuf_spot_check(const iterbuf * buf,
+                        unsigned * checked, unsigned * mismatched);
+
+/* Iterates every pixel of the buffer from scratch */
+void iterbuf_render(iterbuf * buf, iterbuf_kind kind,
+                    complex_region region, complex c,
+                    unsigned maxiters);
+/* Called with each part of a buffer as it is finished or changed */
+typedef void (*iterbuf_progress)(const iterbuf * buf,
+                                 int x, int y, int w, int h, void * arg);
+
+/*
+  iterbuf_render, a tile at a time: tiles nearest pixel (fx,fy) go
+  first, with the cheaper one first where two are as near, and done is
+  called (unless NULL) with each tile as it finishes so it can go up
+  right away. If the fixed-point spot check fails, every tile is done
+  again in double, in the same order.
+*/
+void iterbuf_render_focused(iterbuf * buf, iterbuf_kind kind,
+                            complex_region region, complex c,
+                            unsigned maxiters, int fx, int fy,
+                            iterbuf_progress done, void * arg);
+/* Raises the budget, continuing only the unresolved pixels */
+void iterbuf_extend(iterbuf * buf, unsigned maxiters);
+/* Extends for as long as iterbuf_suggest_maxiters asks for more. If
+   step isn't NULL it gets the whole buffer after every extension. */
+void iterbuf_refine(iterbuf * buf, double base_span,
+                    iterbuf_progress step, void * arg);
+/* iterbuf_refine with each extension done a tile at a time in the
+   order iterbuf_render_focused takes them, done getting each tile */
+void iterbuf_refine_focused(iterbuf * buf, double base_span, int fx, int fy,
+                            iterbuf_progress done, void * arg);
+
+/*
+  Picks the budget for the next frame from this buffer's escape
+  histogram and its zoom depth relative to base_span (the width of the
+  panel's default region).
+*/
+unsigned iterbuf_suggest_maxiters(const iterbuf * buf, double base_span);
+
+/* Copies the counts out in plain row-major order, w * h of them */
+void iterbuf_counts(const iterbuf * buf, unsigned * out);
+
+/* Maps counts through colormap into a 32bpp pixel array; unresolved
+   pixels get the inside color */
+void iterbuf_colorize(const iterbuf * buf, const uint32_t * colormap,
+                      uint32_t inside, uint32_t * pixels, int pitch);
+/* Same, for the w x h part of the buffer at x, y only */
+void iterbuf_colorize_rect(const iterbuf * buf, int x, int y, int w, int h,
+                           const uint32_t * colormap, uint32_t inside,
+                           uint32_t * pixels, int pitch);
+
+#endif
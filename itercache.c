@@ -0,0 +1,340 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "itercache.h"
+
+// FNV-1a, 32 bits for checksums
+static unsigned fnv32(unsigned hash, const void * data, size_t len)
+{
+  const unsigned char * p = data;
+  while (len--)
+    hash = (hash ^ *p++) * 16777619u;
+  return hash;
+}
+
+// FNV-1a, 64 bits for naming files
+static unsigned long long fnv64(unsigned long long hash,
+                                const void * data, size_t len)
+{
+  const unsigned char * p = data;
+  while (len--)
+    hash = (hash ^ *p++) * 1099511628211ull;
+  return hash;
+}
+
+static int cache_dir(char * dir, size_t len)
+{
+  const char * env = getenv("JULIAPREVIEW_CACHE");
+  if (env && *env)
+    snprintf(dir, len, "%s", env);
+  else
+    {
+      const char * home = getenv("HOME");
+      if (home == NULL) return -1;
+      snprintf(dir, len, "%s/.cache/juliapreview", home);
+    }
+  return 0;
+}
+
+static int cache_path(char * path, size_t len, const iterbuf_key * key)
+{
+  char dir[768];
+  if (cache_dir(dir, sizeof dir)) return -1;
+
+  // Hash field by field so struct padding stays out of it
+  unsigned long long hash = 14695981039346656037ull;
+  hash = fnv64(hash, &key->kind, sizeof key->kind);
+  hash = fnv64(hash, &key->kernel, sizeof key->kernel);
+  hash = fnv64(hash, &key->w, sizeof key->w);
+  hash = fnv64(hash, &key->h, sizeof key->h);
+  hash = fnv64(hash, &key->start_maxiters, sizeof key->start_maxiters);
+  hash = fnv64(hash, &key->region.topleft, sizeof(complex));
+  hash = fnv64(hash, &key->region.bottomright, sizeof(complex));
+  hash = fnv64(hash, &key->c, sizeof(complex));
+
+  snprintf(path, len, "%s/%016llx.jpc", dir, hash);
+  return 0;
+}
+
+typedef struct
+{
+  char name[32];
+  unsigned long long size;
+  time_t mtime;
+}
+cache_entry;
+
+static int older_first(const void * a, const void * b)
+{
+  const cache_entry * x = a, * y = b;
+  return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+// Deletes the least recently used entries while dir is over the cap
+static void prune(const char * dir)
+{
+  DIR * d = opendir(dir);
+  if (d == NULL) return;
+
+  cache_entry * entries = NULL;
+  size_t count = 0, room = 0;
+  unsigned long long total = 0;
+  char path[1100];
+  struct dirent * e;
+  while ((e = readdir(d)) != NULL)
+    {
+      // Only finished entries: "<16 hex digits>.jpc"
+      const size_t len = strlen(e->d_name);
+      if (len != 20 || strcmp(e->d_name + 16, ".jpc")) continue;
+      struct stat st;
+      snprintf(path, sizeof path, "%s/%s", dir, e->d_name);
+      if (stat(path, &st)) continue;
+      if (count == room)
+        {
+          room = room ? room * 2 : 256;
+          cache_entry * grown = realloc(entries, sizeof(cache_entry) * room);
+          if (grown == NULL) break;
+          entries = grown;
+        }
+      snprintf(entries[count].name, sizeof entries[count].name, "%s",
+               e->d_name);
+      entries[count].size = st.st_size;
+      entries[count].mtime = st.st_mtime;
+      total += st.st_size;
+      count++;
+    }
+  closedir(d);
+
+  if (total > ITERCACHE_MAX_BYTES)
+    {
+      const unsigned long long target =
+        ITERCACHE_MAX_BYTES / 100 * ITERCACHE_PRUNE_PCT;
+      size_t k;
+      qsort(entries, count, sizeof(cache_entry), older_first);
+      for (k=0; k<count && total > target; k++)
+        {
+          snprintf(path, sizeof path, "%s/%s", dir, entries[k].name);
+          if (!unlink(path)) total -= entries[k].size;
+        }
+    }
+  free(entries);
+}
+
+static void fill_header(itercache_header * head, iterbuf_kind kind,
+                        iterbuf_kernel kernel,
+                        complex_region region, complex c,
+                        int w, int h, unsigned start_maxiters)
+{
+  memset(head, 0, sizeof *head);
+  head->magic = ITERCACHE_MAGIC;
+  head->version = ITERCACHE_VERSION;
+  iterbuf_key_fill(&head->key, kind, kernel, region, c, w, h,
+                   start_maxiters);
+}
+
+static unsigned char * put_varint(unsigned char * p, unsigned v)
+{
+  while (v >= 0x80)
+    {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  *p++ = v;
+  return p;
+}
+
+static const unsigned char * get_varint(const unsigned char * p,
+                                        const unsigned char * end,
+                                        unsigned * v)
+{
+  unsigned shift = 0;
+  *v = 0;
+  while (p < end && shift < 32)
+    {
+      unsigned char b = *p++;
+      *v |= (unsigned) (b & 0x7f) << shift;
+      if (!(b & 0x80)) return p;
+      shift += 7;
+    }
+  return NULL;
+}
+
+int itercache_load(iterbuf * buf, iterbuf_kind kind,
+                   complex_region region, complex c,
+                   int w, int h, unsigned start_maxiters)
+{
+  iterbuf_key key;
+  char path[1024];
+  iterbuf_key_fill(&key, kind, buf->kernel, region, c, w, h, start_maxiters);
+  if (cache_path(path, sizeof path, &key)) return -1;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  // A hit makes the entry recent again, as far as pruning goes
+  futimens(fd, NULL);
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t) sizeof(itercache_header))
+    {
+      close(fd);
+      return -1;
+    }
+  const size_t size = st.st_size;
+  const unsigned char * map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+  madvise((void *) map, size, MADV_SEQUENTIAL);
+
+  const itercache_header * head = (const itercache_header *) map;
+  const unsigned char * runs = map + sizeof(itercache_header);
+  const unsigned char * end = map + size;
+  const unsigned total = w * h;
+  int ok = head->magic == ITERCACHE_MAGIC &&
+    head->version == ITERCACHE_VERSION &&
+    iterbuf_key_equal(&head->key, &key) &&
+    head->runs_size <= size - sizeof(itercache_header) &&
+    size - sizeof(itercache_header) - head->runs_size
+      == sizeof(complex) * (size_t) head->unresolved &&
+    head->unresolved <= total &&
+    fnv32(2166136261u, runs, end - runs) == head->checksum;
+
+  if (ok && (buf->w != w || buf->h != h))
+    ok = !iterbuf_alloc(buf, w, h);
+
+  // Expand the runs, then hand the leftover orbits to unresolved pixels
+  if (ok)
+    {
+      const unsigned char * p = runs;
+      const unsigned char * runs_end = runs + head->runs_size;
+      const complex * z = (const complex *) runs_end;
+      unsigned k = 0, unresolved = 0;
+      while (ok && k < total)
+        {
+          unsigned run, iters;
+          p = get_varint(p, runs_end, &run);
+          if (p) p = get_varint(p, runs_end, &iters);
+          if (p == NULL || run == 0 || run > total - k || iters > head->maxiters)
+            {
+              ok = 0;
+              break;
+            }
+          while (run--)
+            {
+              const size_t at = iterbuf_index(buf, k % w, k / w);
+              buf->iters[at] = iters;
+              if (iters >= head->maxiters)
+                {
+                  if (unresolved == head->unresolved) { ok = 0; break; }
+                  memcpy(&buf->z[at], &z[unresolved++], sizeof(complex));
+                }
+              k++;
+            }
+        }
+      ok = ok && p == runs_end && unresolved == head->unresolved;
+    }
+
+  if (ok)
+    {
+      buf->kind = kind;
+      buf->region = region;
+      buf->c = c;
+      buf->maxiters = head->maxiters;
+      buf->unresolved = head->unresolved;
+      buf->fixed = head->fixed != 0;
+      iterbuf_set_window(buf, 0, 0, w, h);
+    }
+  else
+    buf->maxiters = 0;
+
+  munmap((void *) map, size);
+  return ok ? 0 : -1;
+}
+
+int itercache_store(const iterbuf * buf, unsigned start_maxiters)
+{
+  itercache_header head;
+  char dir[768], path[1024], temp[1100];
+  fill_header(&head, buf->kind, buf->kernel, buf->region, buf->c,
+              buf->w, buf->h, start_maxiters);
+  if (cache_dir(dir, sizeof dir) || cache_path(path, sizeof path, &head.key))
+    return -1;
+
+  // Make the cache directory, and ~/.cache on the way if need be
+  {
+    char * slash;
+    for (slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+      {
+        *slash = '\0';
+        mkdir(dir, 0755);
+        *slash = '/';
+      }
+    if (mkdir(dir, 0755) && errno != EEXIST) return -1;
+  }
+
+  /* Worst case every pixel is its own run of two five-byte varints.
+     Files are row-major whatever the buffer's layout, so the counts
+     are detiled first. */
+  const unsigned total = buf->w * buf->h;
+  const size_t zsize = sizeof(complex) * (size_t) buf->unresolved;
+  unsigned char * data = malloc((size_t) total * 10 + zsize);
+  unsigned * counts = malloc(sizeof(unsigned) * (size_t) total);
+  if (data == NULL || counts == NULL)
+    {
+      free(data);
+      free(counts);
+      return -1;
+    }
+  iterbuf_counts(buf, counts);
+
+  unsigned char * p = data;
+  unsigned k = 0;
+  while (k < total)
+    {
+      unsigned iters = counts[k];
+      unsigned run = 1;
+      while (k + run < total && counts[k + run] == iters)
+        run++;
+      p = put_varint(p, run);
+      p = put_varint(p, iters);
+      k += run;
+    }
+  head.runs_size = p - data;
+  for (k=0; k<total; k++)
+    if (counts[k] >= buf->maxiters)
+      {
+        memcpy(p, &buf->z[iterbuf_index(buf, k % buf->w, k / buf->w)],
+               sizeof(complex));
+        p += sizeof(complex);
+      }
+  free(counts);
+
+  head.maxiters = buf->maxiters;
+  head.unresolved = buf->unresolved;
+  head.fixed = buf->fixed;
+  head.checksum = fnv32(2166136261u, data, p - data);
+
+  // Write to the side and rename, so readers never see half a file
+  snprintf(temp, sizeof temp, "%s.%d", path, (int) getpid());
+  FILE * f = fopen(temp, "wb");
+  int failed = f == NULL;
+  if (!failed)
+    {
+      failed = fwrite(&head, sizeof head, 1, f) != 1 ||
+        fwrite(data, 1, p - data, f) != (size_t) (p - data);
+      if (fclose(f)) failed = 1;
+      if (!failed) failed = rename(temp, path) != 0;
+      if (failed) unlink(temp);
+    }
+  free(data);
+
+  // Once on the first store, then every so often
+  static unsigned stores = 0;
+  if (!failed && stores++ % ITERCACHE_PRUNE_EVERY == 0)
+    prune(dir);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef __ITERCACHE_H
+#define __ITERCACHE_H
+
+#include "iterbuf.h"
+
+/*
+  On-disk cache of finished iteration buffers, so a view that has been
+  rendered before comes back with one page-in instead of a full render.
+
+  Entries live in $JULIAPREVIEW_CACHE, or ~/.cache/juliapreview, one
+  file per key (an iterbuf_key: what went into the render). A buffer
+  may be stored after it was extended past the budget a fresh render
+  would have stopped at, so a hit has at least that budget, and since
+  extending continues orbits exactly, its counts below the fresh
+  budget are the fresh render's.
+
+  The directory is held to ITERCACHE_MAX_BYTES: every so many stores
+  the least recently used entries (by mtime, which a hit refreshes) are
+  deleted until it is back under ITERCACHE_PRUNE_PCT percent of that.
+
+  File layout (native byte order):
+    itercache_header
+    iteration counts as (run length, count) varint pairs, row-major
+    orbit state of each unresolved pixel, row-major, as raw complex
+*/
+
+#define ITERCACHE_MAGIC (0x4349504a) // "JPIC"
+#define ITERCACHE_VERSION (4)
+#define ITERCACHE_MAX_BYTES (1ull << 30)
+#define ITERCACHE_PRUNE_PCT (75)
+#define ITERCACHE_PRUNE_EVERY (64)  // stores between pruning passes
+
+typedef struct
+{
+  unsigned magic;
+  unsigned version;
+  iterbuf_key key;
+  // Contents
+  unsigned maxiters;
+  unsigned unresolved;
+  unsigned fixed;         // rendered with the fixed-point kernel
+  unsigned runs_size;     // bytes of run-length data
+  unsigned checksum;      // FNV-1a over everything after the header
+}
+itercache_header;
+
+/* Fills buf from the cache if the key is there, with buf->kernel as
+   the kernel asked for. Returns 0 on a hit. */
+int itercache_load(iterbuf * buf, iterbuf_kind kind,
+                   complex_region region, complex c,
+                   int w, int h, unsigned start_maxiters);
+/* Saves a rendered buffer under the key it was rendered from.
+   Returns 0 on success. */
+int itercache_store(const iterbuf * buf, unsigned start_maxiters);
+
+#endif
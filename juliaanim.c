@@ -0,0 +1,446 @@
+/*
+  juliaanim
+  Renders an animation of Julia sets (or a Mandelbrot flythrough)
+  without a display
+
+  USAGE:
+  juliaanim [options] KEYFRAMEFILE
+  juliaanim [options] -C
+    -w WIDTH -h HEIGHT  frame size (default 350x350)
+    -n FRAMES           frame count for the -C path (default 300)
+    -t THREADS          render threads (default 4)
+    -f raw|y4m|ppm      output format (default y4m)
+    -o PREFIX           file prefix for ppm output (default "frame")
+    -r FPS              frame rate written into the y4m header (default 30)
+    -m                  render the Mandelbrot over the region; c is ignored
+    -C                  walk c once around the main cardioid instead of
+                        reading keyframes
+
+  raw and y4m go to stdout, so e.g.
+    juliaanim -C | ffmpeg -i - cardioid.mp4
+
+  The keyframe file has one keyframe per line:
+    FRAME CR CI LEFTX TOPY RIGHTX BOTTOMY
+  Frames in between are interpolated; c and the region's center move
+  linearly, and the region's size moves geometrically so zooms look
+  steady. Lines starting with # are ignored.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "complex.h"
+#include "iterbuf.h"
+#include "palette.h"
+
+typedef struct
+{
+  unsigned frame;
+  complex c;
+  complex_region region;
+}
+keyframe;
+
+typedef enum
+{
+  FORMAT_RAW,
+  FORMAT_Y4M,
+  FORMAT_PPM
+}
+output_format;
+
+/*
+  A frame in flight. Workers render into a free slot, the encoder waits
+  for the slot holding the next frame in order, writes it, and frees it.
+  Each finished frame leaves behind the budget it suggests, which seeds
+  the frame SEED_STRIDE further along.
+*/
+typedef enum
+{
+  SLOT_FREE,
+  SLOT_RENDERING,
+  SLOT_DONE
+}
+slot_state;
+
+typedef struct
+{
+  iterbuf buf;
+  unsigned frame;
+  slot_state state;
+}
+slot;
+
+/* Animation parameters */
+#define DEFAULT_SIDELENGTH (350)
+#define DEFAULT_MAXITERS (255)
+#define DEFAULT_FRAMES (300)
+#define DEFAULT_THREADS (4)
+// Frames in flight per render thread
+#define SLOTS_PER_THREAD (2)
+// How far back along the path a frame's budget comes from. It doesn't
+// depend on the thread count, so neither does the output; it also caps
+// the frames that can render at once.
+#define SEED_STRIDE (32)
+
+int WIDTH = DEFAULT_SIDELENGTH;
+int HEIGHT = DEFAULT_SIDELENGTH;
+iterbuf_kind KIND = ITERBUF_JULIA;
+double BASE_SPAN = JULIA_BASE_SPAN;
+
+keyframe * keyframes = NULL;
+unsigned nkeyframes = 0;
+unsigned nframes = 0;
+
+/* Shared between the workers and the encoder */
+slot * slots = NULL;
+unsigned nslots = 0;
+unsigned * seeds = NULL;    // per frame; 0 until the frame is done
+unsigned next_frame = 0;
+pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t slot_changed = PTHREAD_COND_INITIALIZER;
+
+/* Visualization parameters */
+int RGB_PERIOD = 10;
+
+/* Function prototypes */
+int read_keyframes(FILE * f);
+int cardioid_keyframes(unsigned frames);
+// Fills in c and region for any frame along the keyframe path
+void frame_params(unsigned frame, complex * c, complex_region * region);
+void * render_worker(void * arg);
+int write_frame(output_format format, const char * prefix, unsigned frame,
+                const uint32_t * pixels, unsigned char * scratch);
+
+/* Main Function */
+int main (int argc, char * argv[])
+{
+  output_format format = FORMAT_Y4M;
+  const char * prefix = "frame";
+  unsigned threads = DEFAULT_THREADS;
+  unsigned frames = DEFAULT_FRAMES;
+  unsigned fps = 30;
+  int cardioid = 0;
+
+  /* Fetch commandline arguments */
+  int opt;
+  while ((opt = getopt(argc, argv, "w:h:n:t:f:o:r:mC")) != -1)
+    switch (opt)
+      {
+      case 'w': WIDTH = atoi(optarg); break;
+      case 'h': HEIGHT = atoi(optarg); break;
+      case 'n': frames = atoi(optarg); break;
+      case 't': threads = atoi(optarg); break;
+      case 'o': prefix = optarg; break;
+      case 'r': fps = atoi(optarg); break;
+      case 'm':
+        KIND = ITERBUF_MANDELBROT;
+        BASE_SPAN = MANDELBROT_BASE_SPAN;
+        break;
+      case 'C': cardioid = 1; break;
+      case 'f':
+        if (!strcmp(optarg, "raw")) format = FORMAT_RAW;
+        else if (!strcmp(optarg, "y4m")) format = FORMAT_Y4M;
+        else if (!strcmp(optarg, "ppm")) format = FORMAT_PPM;
+        else { fprintf(stderr,"Unknown format %s\n", optarg); return -1; }
+        break;
+      default:
+        fprintf(stderr,"See the top of juliaanim.c for usage\n");
+        return -1;
+      }
+  if (WIDTH <= 0 || HEIGHT <= 0 || threads == 0 || fps == 0)
+    { fprintf(stderr,"Bad frame size, thread count or rate\n"); return -1; }
+
+  if (cardioid)
+    {
+      if (cardioid_keyframes(frames))
+        { fprintf(stderr,"Keyframe allocation failed\n"); return -1; }
+    }
+  else if (optind < argc)
+    {
+      FILE * f = strcmp(argv[optind], "-") ? fopen(argv[optind], "r") : stdin;
+      if (f == NULL)
+        { fprintf(stderr,"Can't open %s\n", argv[optind]); return -1; }
+      int failed = read_keyframes(f);
+      if (f != stdin) fclose(f);
+      if (failed) return -1;
+    }
+  else
+    { fprintf(stderr,"Need a keyframe file or -C\n"); return -1; }
+
+  nframes = keyframes[nkeyframes - 1].frame + 1;
+  fprintf(stderr,"Rendering %u frames at %dx%d on %u threads\n",
+          nframes, WIDTH, HEIGHT, threads);
+
+  /* Set up the frame slots */
+  nslots = threads * SLOTS_PER_THREAD;
+  slots = calloc(nslots, sizeof(slot));
+  seeds = calloc(nframes, sizeof(unsigned));
+  if (slots == NULL || seeds == NULL)
+    { fprintf(stderr,"Slot allocation failed\n"); return -1; }
+  {
+    unsigned i;
+    for (i=0; i<nslots; i++)
+      if (iterbuf_alloc(&slots[i].buf, WIDTH, HEIGHT))
+        { fprintf(stderr,"Iteration buffer allocation failed\n"); return -1; }
+  }
+  uint32_t * pixels = malloc(sizeof(uint32_t) * WIDTH * HEIGHT);
+  unsigned char * scratch = malloc(3 * WIDTH * HEIGHT);
+  if (pixels == NULL || scratch == NULL)
+    { fprintf(stderr,"Frame allocation failed\n"); return -1; }
+  unsigned colormap_size = MAXITERS_CAP + 1;
+  uint32_t * colormap = palette_build(colormap_size, RGB_PERIOD);
+  if (colormap == NULL)
+    { fprintf(stderr,"Colormap allocation failed\n"); return -1; }
+
+  /* Start the renderers */
+  pthread_t * workers = malloc(sizeof(pthread_t) * threads);
+  if (workers == NULL)
+    { fprintf(stderr,"Thread allocation failed\n"); return -1; }
+  {
+    unsigned i;
+    for (i=0; i<threads; i++)
+      if (pthread_create(&workers[i], NULL, render_worker, NULL))
+        { fprintf(stderr,"Thread start failed\n"); return -1; }
+  }
+
+  /* The main thread colors and writes frames in order as they finish */
+  if (format == FORMAT_Y4M)
+    printf("YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444 XCOLORRANGE=FULL\n",
+           WIDTH, HEIGHT, fps);
+  unsigned n;
+  for (n=0; n<nframes; n++)
+    {
+      slot * s = &slots[n % nslots];
+      pthread_mutex_lock(&slot_lock);
+      while (s->state != SLOT_DONE || s->frame != n)
+        pthread_cond_wait(&slot_changed, &slot_lock);
+      pthread_mutex_unlock(&slot_lock);
+
+      iterbuf_colorize(&s->buf, colormap, 0, pixels, WIDTH);
+      unsigned maxiters = s->buf.maxiters;
+
+      // Let a worker have the slot back before we block on I/O
+      pthread_mutex_lock(&slot_lock);
+      s->state = SLOT_FREE;
+      pthread_cond_broadcast(&slot_changed);
+      pthread_mutex_unlock(&slot_lock);
+
+      if (write_frame(format, prefix, n, pixels, scratch))
+        { fprintf(stderr,"Write failed on frame %u\n", n); return -1; }
+      fprintf(stderr,"  frame %u (maxiters %u)\n", n, maxiters);
+    }
+  fflush(stdout);
+
+  {
+    unsigned i;
+    for (i=0; i<threads; i++)
+      pthread_join(workers[i], NULL);
+  }
+  return 0;
+}
+
+int read_keyframes(FILE * f)
+{
+  char line[512];
+  unsigned lineno = 0;
+  unsigned allocated = 0;
+  while (fgets(line, sizeof line, f))
+    {
+      lineno++;
+      if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+        continue;
+
+      keyframe k;
+      if (sscanf(line, "%u %lf %lf %lf %lf %lf %lf", &k.frame,
+                 &k.c.r, &k.c.i,
+                 &k.region.topleft.r, &k.region.topleft.i,
+                 &k.region.bottomright.r, &k.region.bottomright.i) != 7)
+        { fprintf(stderr,"Bad keyframe on line %u\n", lineno); return -1; }
+      if (nkeyframes && k.frame <= keyframes[nkeyframes - 1].frame)
+        {
+          fprintf(stderr,"Keyframes out of order on line %u\n", lineno);
+          return -1;
+        }
+
+      if (nkeyframes == allocated)
+        {
+          allocated = allocated ? allocated * 2 : 16;
+          keyframe * grown = realloc(keyframes, sizeof(keyframe) * allocated);
+          if (grown == NULL)
+            { fprintf(stderr,"Keyframe allocation failed\n"); return -1; }
+          keyframes = grown;
+        }
+      keyframes[nkeyframes++] = k;
+    }
+
+  if (nkeyframes == 0)
+    { fprintf(stderr,"No keyframes\n"); return -1; }
+  return 0;
+}
+
+int cardioid_keyframes(unsigned frames)
+{
+  if (frames == 0) return -1;
+  keyframes = malloc(sizeof(keyframe) * frames);
+  if (keyframes == NULL) return -1;
+
+  // c(t) = e^it / 2 - e^2it / 4 traces the main cardioid's edge
+  const complex_region julia_region = JULIA_DEFAULT_REGION;
+  unsigned i;
+  for (i=0; i<frames; i++)
+    {
+      double t = 2 * M_PI * i / frames;
+      keyframes[i].frame = i;
+      keyframes[i].c.r = cos(t) / 2 - cos(2 * t) / 4;
+      keyframes[i].c.i = sin(t) / 2 - sin(2 * t) / 4;
+      keyframes[i].region = julia_region;
+    }
+  nkeyframes = frames;
+  return 0;
+}
+
+double lerp(double a, double b, double t)
+{
+  return a + (b - a) * t;
+}
+
+// Geometric interpolation, falling back to linear across a sign change
+double glerp(double a, double b, double t)
+{
+  if (a * b <= 0)
+    return lerp(a, b, t);
+  return copysign(exp(lerp(log(fabs(a)), log(fabs(b)), t)), a);
+}
+
+void frame_params(unsigned frame, complex * c, complex_region * region)
+{
+  // Find the keyframes either side of this frame
+  unsigned k = 0;
+  while (k + 1 < nkeyframes && keyframes[k + 1].frame <= frame)
+    k++;
+  const keyframe * a = &keyframes[k];
+  if (k + 1 == nkeyframes || frame == a->frame)
+    {
+      *c = a->c;
+      *region = a->region;
+      return;
+    }
+  const keyframe * b = &keyframes[k + 1];
+  double t = (double) (frame - a->frame) / (b->frame - a->frame);
+
+  c->r = lerp(a->c.r, b->c.r, t);
+  c->i = lerp(a->c.i, b->c.i, t);
+
+  // Centers move linearly, half-extents geometrically
+  double acr = (a->region.topleft.r + a->region.bottomright.r) / 2;
+  double aci = (a->region.topleft.i + a->region.bottomright.i) / 2;
+  double bcr = (b->region.topleft.r + b->region.bottomright.r) / 2;
+  double bci = (b->region.topleft.i + b->region.bottomright.i) / 2;
+  double ahr = (a->region.bottomright.r - a->region.topleft.r) / 2;
+  double ahi = (a->region.bottomright.i - a->region.topleft.i) / 2;
+  double bhr = (b->region.bottomright.r - b->region.topleft.r) / 2;
+  double bhi = (b->region.bottomright.i - b->region.topleft.i) / 2;
+  double hr = glerp(ahr, bhr, t);
+  double hi = glerp(ahi, bhi, t);
+  double cr = lerp(acr, bcr, t);
+  double ci = lerp(aci, bci, t);
+
+  region->topleft.r = cr - hr;
+  region->topleft.i = ci - hi;
+  region->bottomright.r = cr + hr;
+  region->bottomright.i = ci + hi;
+}
+
+void * render_worker(void * arg)
+{
+  while (1)
+    {
+      // Claim the next frame and wait for its slot to come free
+      pthread_mutex_lock(&slot_lock);
+      if (next_frame >= nframes)
+        {
+          pthread_mutex_unlock(&slot_lock);
+          return NULL;
+        }
+      unsigned n = next_frame++;
+      slot * s = &slots[n % nslots];
+      /* Frame n - SEED_STRIDE is close enough along the path to say
+         what budget this frame will want. Going by that frame rather
+         than whichever finished last keeps the output the same from
+         run to run and at any thread count. */
+      const unsigned * seed = n >= SEED_STRIDE ? &seeds[n - SEED_STRIDE] : NULL;
+      // The slot is ours once the frame before us there is written; a
+      // frame further on waiting for it as well mustn't get in first
+      while (s->state != SLOT_FREE ||
+             (n >= nslots && s->frame != n - nslots) ||
+             (seed && *seed == 0))
+        pthread_cond_wait(&slot_changed, &slot_lock);
+      s->state = SLOT_RENDERING;
+      const unsigned maxiters = seed ? *seed : DEFAULT_MAXITERS;
+      pthread_mutex_unlock(&slot_lock);
+
+      complex c;
+      complex_region region;
+      frame_params(n, &c, &region);
+      iterbuf_render(&s->buf, KIND, region, c, maxiters);
+      iterbuf_refine(&s->buf, BASE_SPAN, NULL, NULL);
+      const unsigned next = iterbuf_suggest_maxiters(&s->buf, BASE_SPAN);
+
+      pthread_mutex_lock(&slot_lock);
+      seeds[n] = next;
+      s->frame = n;
+      s->state = SLOT_DONE;
+      pthread_cond_broadcast(&slot_changed);
+      pthread_mutex_unlock(&slot_lock);
+    }
+}
+
+int write_frame(output_format format, const char * prefix, unsigned frame,
+                const uint32_t * pixels, unsigned char * scratch)
+{
+  const unsigned count = WIDTH * HEIGHT;
+  unsigned i;
+
+  if (format == FORMAT_Y4M)
+    {
+      // BT.601 full-range planes, one each for Y, U and V
+      unsigned char * y = scratch;
+      unsigned char * u = scratch + count;
+      unsigned char * v = scratch + 2 * count;
+      for (i=0; i<count; i++)
+        {
+          int r = (pixels[i] >> 16) & 0xff;
+          int g = (pixels[i] >> 8) & 0xff;
+          int b = pixels[i] & 0xff;
+          y[i] = (77 * r + 150 * g + 29 * b) >> 8;
+          u[i] = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+          v[i] = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+        }
+      if (fputs("FRAME\n", stdout) == EOF) return -1;
+      return fwrite(scratch, 1, 3 * count, stdout) == 3 * count ? 0 : -1;
+    }
+
+  if (format == FORMAT_RAW)
+    {
+      for (i=0; i<count; i++)
+        {
+          scratch[3 * i] = (pixels[i] >> 16) & 0xff;
+          scratch[3 * i + 1] = (pixels[i] >> 8) & 0xff;
+          scratch[3 * i + 2] = pixels[i] & 0xff;
+        }
+      return fwrite(scratch, 1, 3 * count, stdout) == 3 * count ? 0 : -1;
+    }
+
+  char name[1024];
+  snprintf(name, sizeof name, "%s%05u.ppm", prefix, frame);
+  FILE * f = fopen(name, "wb");
+  if (f == NULL) return -1;
+  int failed = palette_write_ppm(f, pixels, WIDTH, HEIGHT);
+  if (fclose(f)) failed = -1;
+  return failed;
+}
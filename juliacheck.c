@@ -0,0 +1,655 @@
+/*
+  juliacheck
+  Holds the fast render paths to the plain scalar iteration, without a
+  display
+
+  USAGE:
+  juliacheck [options]
+    -w WIDTH -h HEIGHT  image size (default 320x240)
+    -m MAXITERS         budget every scene is rendered to (default 1000)
+    -d DIR              write a diff image per scene and path into DIR
+    -s                  turn the AVX2 code off, to check the plain C
+                        kernels and colorizer it stands in for
+
+  Every scene in the corpus is rendered once through the reference
+  (mandelbrot_iterate/julia_iterate, one pixel at a time) and once
+  through each fast path, at the same budget. For each pair it prints
+  how many pixels disagree and the largest difference in count, and
+  checks them against the path's tolerance: exact for paths that only
+  rearrange the same arithmetic, looser for reduced precision. Exits
+  nonzero if any path is out of tolerance.
+
+  The served path asks a juliaserver of its own, started from
+  ./juliaserver on a scratch socket, and is n/a without one. No other
+  path sees a render server, or the user's disk cache. The colorized
+  path goes through iterbuf_colorize with the counts themselves for
+  colors, so the colorizer is held to the reference as well.
+
+  Diff images show the reference dimmed, with pixels the fast path
+  counted higher in red and lower in cyan, brighter for bigger
+  differences.
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "complex.h"
+#include "iterbuf.h"
+#include "itercache.h"
+#include "palette.h"
+#include "pyramid.h"
+#include "renderclient.h"
+
+typedef struct
+{
+  const char * name;
+  iterbuf_kind kind;
+  complex_region region;
+  complex c;
+}
+scene;
+
+// Runs one fast path over a scene into buf. Returns 0 when done, 1
+// when the path doesn't apply to this scene, -1 on failure.
+typedef int (*render_path)(iterbuf * buf, const scene * s, unsigned maxiters);
+
+typedef struct
+{
+  const char * name;
+  render_path render;
+  double max_mismatch_pct;
+  unsigned max_delta;
+}
+fast_path;
+
+#define ANY_DELTA (~0u)
+
+/* Check parameters */
+#define DEFAULT_WIDTH (320)
+#define DEFAULT_HEIGHT (240)
+#define DEFAULT_MAXITERS (1000)
+#define TILE_SIDELENGTH (64)
+#define PYRAMID_MAX_MISMATCH_PCT (0.1)
+
+int WIDTH = DEFAULT_WIDTH;
+int HEIGHT = DEFAULT_HEIGHT;
+
+// A juliaserver of our own for the served path, on a scratch socket;
+// every other path is pointed at a socket nobody listens on
+pid_t server_pid = -1;
+char server_socket[256], no_socket[256];
+
+/* Visualization parameters */
+int RGB_PERIOD = 10;
+
+/* Function prototypes */
+unsigned mandelbrot_iterate(complex c, unsigned maxiters);
+unsigned julia_iterate(complex z, const complex c, unsigned maxiters);
+void render_reference(const scene * s, unsigned maxiters, unsigned * iters);
+int render_double(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_fixed(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_auto(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_resumed(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_tiled(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_tiled_auto(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_focused(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_focused_double(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_focus_refined(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_cached(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_pyramid(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_pyramid_auto(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_served(iterbuf * buf, const scene * s, unsigned maxiters);
+int render_colorized(iterbuf * buf, const scene * s, unsigned maxiters);
+int write_diff(const char * path, const unsigned * ref, const unsigned * fast,
+               unsigned maxiters, const uint32_t * colormap);
+pid_t start_server(const char * path);
+
+const scene scenes[] =
+  {
+    { "mandelbrot", ITERBUF_MANDELBROT, MANDELBROT_DEFAULT_REGION, {0, 0} },
+    { "seahorse-valley", ITERBUF_MANDELBROT,
+      {{-0.76, 0.115}, {-0.73, 0.09}}, {0, 0} },
+    // Too deep for the fixed-point kernel, so it has to say no
+    { "minibrot", ITERBUF_MANDELBROT,
+      {{-1.7548776667, 0.0000000004}, {-1.7548776657, -0.0000000004}},
+      {0, 0} },
+    { "julia-dragon", ITERBUF_JULIA, {{-2, 1.5}, {2, -1.5}}, {-0.8, 0.156} },
+    { "julia-rabbit", ITERBUF_JULIA, {{-1.6, 1.2}, {1.6, -1.2}},
+      {-0.123, 0.745} },
+    { "julia-dendrite", ITERBUF_JULIA, {{-1.6, 1.2}, {1.6, -1.2}}, {0, 1} },
+    { "julia-zoom", ITERBUF_JULIA, {{-0.1, 0.075}, {0.1, -0.075}},
+      {0.285, 0.01} },
+  };
+
+/*
+  Tolerances: the double paths are the reference's own arithmetic
+  rearranged, so they have to match exactly. Fixed point rounds
+  differently, and on chaotic orbits that can move a count anywhere,
+  so only the share of pixels that move is held down. auto has its
+  spot check to keep it near FIXED_MAX_MISMATCH_PCT, tile by tile in
+  tiled-auto; fixed on its own is fixed point forced on every scene
+  it is permitted for, boundary-heavy ones included; focused is auto
+  a tile at a time, with one spot check over the lot. The pyramid's
+  tiles sample the plane from their own corners, a rounding away from
+  the reference's points, so a few boundary pixels may move there.
+  pyramid-auto is the pyramid with each level settled by one spot check
+  over its tiles.
+  Paths that refine past the budget are compared with their counts
+  cut off at it.
+*/
+const fast_path paths[] =
+  {
+    { "double", render_double, 0, 0 },
+    { "fixed", render_fixed, 5, ANY_DELTA },
+    { "auto", render_auto, 2, ANY_DELTA },
+    { "resumed", render_resumed, 0, 0 },
+    { "tiled", render_tiled, 0, 0 },
+    { "tiled-auto", render_tiled_auto, 2, ANY_DELTA },
+    { "focused", render_focused, 2, ANY_DELTA },
+    { "focused-dbl", render_focused_double, 0, 0 },
+    { "focus-refine", render_focus_refined, 0, 0 },
+    { "cached", render_cached, 0, 0 },
+    { "pyramid", render_pyramid, PYRAMID_MAX_MISMATCH_PCT, ANY_DELTA },
+    { "pyramid-auto", render_pyramid_auto, 2, ANY_DELTA },
+    { "served", render_served, 0, 0 },
+    { "colorized", render_colorized, 0, 0 },
+  };
+
+#define NSCENES (sizeof scenes / sizeof scenes[0])
+#define NPATHS (sizeof paths / sizeof paths[0])
+
+/* Main Function */
+int main (int argc, char * argv[])
+{
+  unsigned maxiters = DEFAULT_MAXITERS;
+  const char * diffdir = NULL;
+
+  /* Fetch commandline arguments */
+  int opt;
+  while ((opt = getopt(argc, argv, "w:h:m:d:s")) != -1)
+    switch (opt)
+      {
+      case 'w': WIDTH = atoi(optarg); break;
+      case 'h': HEIGHT = atoi(optarg); break;
+      case 'm': maxiters = atoi(optarg); break;
+      case 'd': diffdir = optarg; break;
+      case 's': iterbatch_set_simd(0); break;
+      default:
+        fprintf(stderr,"See the top of juliacheck.c for usage\n");
+        return -1;
+      }
+  if (WIDTH <= 0 || HEIGHT <= 0 || maxiters < 16 || maxiters > MAXITERS_CAP)
+    { fprintf(stderr,"Bad image size or budget\n"); return -1; }
+
+  // The cached path mustn't touch the user's cache, or find old entries
+  char cachedir[] = "/tmp/juliacheck-XXXXXX";
+  if (mkdtemp(cachedir) == NULL)
+    { fprintf(stderr,"Can't make a scratch cache directory\n"); return -1; }
+  setenv("JULIAPREVIEW_CACHE", cachedir, 1);
+  // Nor a render server that happens to be running
+  snprintf(no_socket, sizeof no_socket, "%s/none.sock", cachedir);
+  snprintf(server_socket, sizeof server_socket, "%s/render.sock", cachedir);
+  setenv(RENDER_SOCKET_ENV, no_socket, 1);
+  server_pid = start_server(server_socket);
+
+  const unsigned total = WIDTH * HEIGHT;
+  unsigned * ref = malloc(sizeof(unsigned) * total);
+  unsigned * fast = malloc(sizeof(unsigned) * total);
+  uint32_t * colormap = palette_build(maxiters, RGB_PERIOD);
+  iterbuf buf;
+  memset(&buf, 0, sizeof buf);
+  if (ref == NULL || fast == NULL || colormap == NULL || iterbuf_alloc(&buf, WIDTH, HEIGHT))
+    { fprintf(stderr,"Allocation failed\n"); return -1; }
+
+  printf("AVX2 code %s\n", iterbatch_simd() ? "on" : "off");
+  printf("%-16s %-13s %20s %10s\n", "scene", "path", "mismatched", "max delta");
+  unsigned failures = 0;
+  unsigned i, p;
+  for (i=0; i<NSCENES; i++)
+    {
+      const scene * s = &scenes[i];
+      render_reference(s, maxiters, ref);
+
+      for (p=0; p<NPATHS; p++)
+        {
+          const fast_path * path = &paths[p];
+          // Nothing may leak from one path into the next
+          iterbuf_free(&buf);
+          memset(&buf, 0, sizeof buf);
+          if (iterbuf_alloc(&buf, WIDTH, HEIGHT))
+            { fprintf(stderr,"Allocation failed\n"); return -1; }
+
+          int status = path->render(&buf, s, maxiters);
+          if (status > 0)
+            {
+              printf("%-16s %-13s %20s\n", s->name, path->name, "(n/a)");
+              continue;
+            }
+          if (status < 0 || buf.maxiters != maxiters)
+            {
+              printf("%-16s %-13s %20s  FAIL\n", s->name, path->name,
+                     "(no render)");
+              failures++;
+              continue;
+            }
+
+          unsigned mismatched = 0, max_delta = 0;
+          unsigned k;
+          iterbuf_counts(&buf, fast);
+          for (k=0; k<total; k++)
+            if (fast[k] != ref[k])
+              {
+                unsigned delta = fast[k] > ref[k] ?
+                  fast[k] - ref[k] : ref[k] - fast[k];
+                mismatched++;
+                if (delta > max_delta) max_delta = delta;
+              }
+
+          const double pct = 100.0 * mismatched / total;
+          int ok = pct <= path->max_mismatch_pct &&
+            (path->max_delta == ANY_DELTA || max_delta <= path->max_delta);
+          char counts[64];
+          snprintf(counts, sizeof counts, "%u (%.3f%%)", mismatched, pct);
+          printf("%-16s %-13s %20s %10u  %s\n", s->name, path->name,
+                 counts, max_delta, ok ? "ok" : "FAIL");
+          if (!ok) failures++;
+
+          if (diffdir && mismatched)
+            {
+              char name[1024];
+              snprintf(name, sizeof name, "%s/%s-%s.ppm", diffdir,
+                       s->name, path->name);
+              if (write_diff(name, ref, fast, maxiters, colormap))
+                fprintf(stderr,"Couldn't write %s\n", name);
+            }
+        }
+    }
+
+  if (server_pid > 0)
+    {
+      kill(server_pid, SIGTERM);
+      waitpid(server_pid, NULL, 0);
+    }
+
+  // Clear out the scratch cache
+  {
+    DIR * dir = opendir(cachedir);
+    struct dirent * entry;
+    while (dir && (entry = readdir(dir)) != NULL)
+      {
+        char name[1024];
+        if (entry->d_name[0] == '.') continue;
+        snprintf(name, sizeof name, "%s/%s", cachedir, entry->d_name);
+        unlink(name);
+      }
+    if (dir) closedir(dir);
+    rmdir(cachedir);
+  }
+
+  if (failures)
+    fprintf(stderr,"%u fast path%s out of tolerance\n", failures,
+            failures == 1 ? "" : "s");
+  return failures ? 1 : 0;
+}
+
+/*** Reference ***/
+
+unsigned mandelbrot_iterate(complex c, unsigned maxiters)
+{
+  complex z = {0,0};
+  unsigned iters = 0;
+  while (++iters < maxiters && complex_sqmag(z) <= 4)
+    z = complex_add(complex_mult(z, z), c);
+
+  return iters;
+}
+
+unsigned julia_iterate(complex z, const complex c, unsigned maxiters)
+{
+  unsigned iters = 0;
+  while (++iters < maxiters && complex_sqmag(z) <= 4)
+    z = complex_add(complex_mult(z, z), c);
+
+  return iters;
+}
+
+void render_reference(const scene * s, unsigned maxiters, unsigned * iters)
+{
+  const complex_region * r = &s->region;
+  int i,j;
+  for (j=0; j<HEIGHT; j++)
+    for (i=0; i<WIDTH; i++)
+      {
+        complex p;
+        p.r = r->topleft.r + (r->bottomright.r - r->topleft.r) * i / WIDTH;
+        p.i = r->topleft.i + (r->bottomright.i - r->topleft.i) * j / HEIGHT;
+        iters[j * WIDTH + i] = s->kind == ITERBUF_JULIA ?
+          julia_iterate(p, s->c, maxiters) : mandelbrot_iterate(p, maxiters);
+      }
+}
+
+/*** Fast paths ***/
+
+int render_double(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  buf->kernel = ITERBUF_KERNEL_DOUBLE;
+  iterbuf_render(buf, s->kind, s->region, s->c, maxiters);
+  return 0;
+}
+
+int render_fixed(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  buf->kind = s->kind;
+  buf->region = s->region;
+  buf->c = s->c;
+  if (!iterbuf_fixed_permitted(buf)) return 1;
+  buf->kernel = ITERBUF_KERNEL_FIXED;
+  iterbuf_render(buf, s->kind, s->region, s->c, maxiters);
+  return 0;
+}
+
+int render_auto(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  buf->kernel = ITERBUF_KERNEL_AUTO;
+  iterbuf_render(buf, s->kind, s->region, s->c, maxiters);
+  return 0;
+}
+
+// Starts low and extends in steps, the way refinement does
+int render_resumed(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  buf->kernel = ITERBUF_KERNEL_DOUBLE;
+  iterbuf_render(buf, s->kind, s->region, s->c, maxiters / 8);
+  iterbuf_extend(buf, maxiters / 2);
+  iterbuf_extend(buf, maxiters);
+  return 0;
+}
+
+// Renders in windows of the full image and pastes them together, the
+// way juliafarm's workers do
+static int render_windows(iterbuf * buf, const scene * s, unsigned maxiters,
+                          iterbuf_kernel kernel)
+{
+  iterbuf tile;
+  memset(&tile, 0, sizeof tile);
+  int x, y;
+  for (y=0; y<HEIGHT; y+=TILE_SIDELENGTH)
+    for (x=0; x<WIDTH; x+=TILE_SIDELENGTH)
+      {
+        int w = WIDTH - x < TILE_SIDELENGTH ? WIDTH - x : TILE_SIDELENGTH;
+        int h = HEIGHT - y < TILE_SIDELENGTH ? HEIGHT - y : TILE_SIDELENGTH;
+        if (tile.w != w || tile.h != h)
+          if (iterbuf_alloc(&tile, w, h))
+            {
+              iterbuf_free(&tile);
+              return -1;
+            }
+        iterbuf_set_window(&tile, x, y, WIDTH, HEIGHT);
+        tile.kernel = kernel;
+        iterbuf_render(&tile, s->kind, s->region, s->c, maxiters);
+        int i,j;
+        for (j=0; j<h; j++)
+          for (i=0; i<w; i++)
+            buf->iters[iterbuf_index(buf, x + i, y + j)] =
+              tile.iters[iterbuf_index(&tile, i, j)];
+      }
+  iterbuf_free(&tile);
+  buf->maxiters = maxiters;
+  return 0;
+}
+
+int render_tiled(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  return render_windows(buf, s, maxiters, ITERBUF_KERNEL_DOUBLE);
+}
+
+// Every tile runs its own spot check
+int render_tiled_auto(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  return render_windows(buf, s, maxiters, ITERBUF_KERNEL_AUTO);
+}
+
+// Tile by tile from off-center, the way the Julia panel draws
+static int render_from_focus(iterbuf * buf, const scene * s,
+                             unsigned maxiters, iterbuf_kernel kernel)
+{
+  buf->kernel = kernel;
+  iterbuf_render_focused(buf, s->kind, s->region, s->c, maxiters,
+                         WIDTH / 3, HEIGHT / 3, NULL, NULL);
+  return 0;
+}
+
+int render_focused(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  return render_from_focus(buf, s, maxiters, ITERBUF_KERNEL_AUTO);
+}
+
+int render_focused_double(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  return render_from_focus(buf, s, maxiters, ITERBUF_KERNEL_DOUBLE);
+}
+
+// Then extended tile by tile as well, the way the panel goes on
+int render_focus_refined(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  render_from_focus(buf, s, maxiters, ITERBUF_KERNEL_DOUBLE);
+  const double base_span = s->kind == ITERBUF_JULIA ?
+    JULIA_BASE_SPAN : MANDELBROT_BASE_SPAN;
+  iterbuf_refine_focused(buf, base_span, WIDTH / 3, HEIGHT / 3, NULL, NULL);
+
+  int i,j;
+  for (j=0; j<HEIGHT; j++)
+    for (i=0; i<WIDTH; i++)
+      {
+        const size_t at = iterbuf_index(buf, i, j);
+        if (buf->iters[at] > maxiters) buf->iters[at] = maxiters;
+      }
+  buf->maxiters = maxiters;
+  return 0;
+}
+
+// Through the disk cache and back
+int render_cached(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  buf->kernel = ITERBUF_KERNEL_DOUBLE;
+  iterbuf_render(buf, s->kind, s->region, s->c, maxiters);
+  if (itercache_store(buf, maxiters)) return -1;
+  memset(buf->iters, 0, iterbuf_mapping_size(buf->w, buf->h));
+  buf->maxiters = 0;
+  if (itercache_load(buf, s->kind, s->region, s->c, buf->w, buf->h, maxiters))
+    return -1;
+  return 0;
+}
+
+/*
+  A level 0 pyramid view laid exactly over the scene, assembled by
+  pyramid_paint. The colormap is the identity up to the budget, so the
+  "colors" painted are the counts themselves, cut off at maxiters.
+*/
+static int render_pyramid_with(iterbuf * buf, const scene * s,
+                               unsigned maxiters, iterbuf_kernel kernel)
+{
+  if (s->kind != ITERBUF_MANDELBROT) return 1;
+
+  const complex_region * r = &s->region;
+  complex tile_span;
+  tile_span.r = (r->bottomright.r - r->topleft.r) * PYRAMID_TILE / WIDTH;
+  tile_span.i = (r->bottomright.i - r->topleft.i) * PYRAMID_TILE / HEIGHT;
+  pyramid p;
+  if (pyramid_init(&p, r->topleft, tile_span,
+                   MANDELBROT_BASE_SPAN * PYRAMID_TILE / WIDTH,
+                   maxiters, PYRAMID_BYTES))
+    return -1;
+  p.kernel = kernel;
+
+  pyramid_view view = { 0, 0, 0, WIDTH, HEIGHT };
+  const unsigned top = pyramid_render_view(&p, &view);
+  uint32_t * colormap = malloc(sizeof(uint32_t) * ((size_t) top + 1));
+  uint32_t * counts = malloc(sizeof(uint32_t) * WIDTH * HEIGHT);
+  int status = -1;
+  if (top && colormap && counts)
+    {
+      unsigned k;
+      for (k=0; k<=top; k++)
+        colormap[k] = k < maxiters ? k : maxiters;
+      pyramid_paint(&p, &view, colormap, maxiters, counts, WIDTH);
+      int i,j;
+      for (j=0; j<HEIGHT; j++)
+        for (i=0; i<WIDTH; i++)
+          buf->iters[iterbuf_index(buf, i, j)] = counts[j * WIDTH + i];
+      buf->maxiters = maxiters;
+      status = 0;
+    }
+  free(colormap);
+  free(counts);
+  pyramid_free(&p);
+  return status;
+}
+
+// The assembly on its own, in double
+int render_pyramid(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  return render_pyramid_with(buf, s, maxiters, ITERBUF_KERNEL_DOUBLE);
+}
+
+int render_pyramid_auto(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  return render_pyramid_with(buf, s, maxiters, ITERBUF_KERNEL_AUTO);
+}
+
+// Asked of our own juliaserver, in double, which refines past the budget
+int render_served(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  if (server_pid <= 0) return 1;
+
+  iterbuf served;
+  memset(&served, 0, sizeof served);
+  served.kernel = ITERBUF_KERNEL_DOUBLE;
+  setenv(RENDER_SOCKET_ENV, server_socket, 1);
+  int failed = renderclient_fetch(&served, s->kind, s->region, s->c,
+                                  WIDTH, HEIGHT, maxiters);
+  setenv(RENDER_SOCKET_ENV, no_socket, 1);
+  if (failed) return -1;
+
+  // Same size, so the same layout
+  int i,j;
+  for (j=0; j<HEIGHT; j++)
+    for (i=0; i<WIDTH; i++)
+      {
+        const size_t at = iterbuf_index(buf, i, j);
+        buf->iters[at] = served.iters[at] < maxiters ?
+          served.iters[at] : maxiters;
+      }
+  buf->maxiters = maxiters;
+  iterbuf_free(&served);
+  return 0;
+}
+
+/*
+  Rendered in double and put through iterbuf_colorize, with the
+  identity for a colormap and maxiters for inside, so the "colors" are
+  the counts again.
+*/
+int render_colorized(iterbuf * buf, const scene * s, unsigned maxiters)
+{
+  uint32_t * colormap = malloc(sizeof(uint32_t) * maxiters);
+  uint32_t * pixels = malloc(sizeof(uint32_t) * WIDTH * HEIGHT);
+  int status = -1;
+  if (colormap && pixels)
+    {
+      unsigned k;
+      for (k=0; k<maxiters; k++)
+        colormap[k] = k;
+      buf->kernel = ITERBUF_KERNEL_DOUBLE;
+      iterbuf_render(buf, s->kind, s->region, s->c, maxiters);
+      iterbuf_colorize(buf, colormap, maxiters, pixels, WIDTH);
+      int i,j;
+      for (j=0; j<HEIGHT; j++)
+        for (i=0; i<WIDTH; i++)
+          buf->iters[iterbuf_index(buf, i, j)] = pixels[j * WIDTH + i];
+      status = 0;
+    }
+  free(colormap);
+  free(pixels);
+  return status;
+}
+
+/*** Render server ***/
+
+// Runs ./juliaserver on path and waits for it to listen. Returns its
+// pid, or -1 if there is no server to be had.
+pid_t start_server(const char * path)
+{
+  pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0)
+    {
+      // Its log would land in the middle of the table
+      int devnull = open("/dev/null", O_WRONLY);
+      if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+      execl("./juliaserver", "juliaserver", path, (char *) NULL);
+      _exit(127);
+    }
+
+  // Up once a connection goes through; the client only tries once
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+  int tries;
+  for (tries=0; tries<200; tries++)
+    {
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      int up = fd >= 0 &&
+        connect(fd, (struct sockaddr *) &addr, sizeof addr) == 0;
+      if (fd >= 0) close(fd);
+      if (up) return pid;
+      if (waitpid(pid, NULL, WNOHANG) == pid) return -1;
+      usleep(10000);
+    }
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  return -1;
+}
+
+/*** Output ***/
+
+int write_diff(const char * path, const unsigned * ref, const unsigned * fast,
+               unsigned maxiters, const uint32_t * colormap)
+{
+  const unsigned total = WIDTH * HEIGHT;
+  uint32_t * pixels = malloc(sizeof(uint32_t) * total);
+  if (pixels == NULL) return -1;
+
+  const double scale = 255 / log2(maxiters + 1.0);
+  unsigned k;
+  for (k=0; k<total; k++)
+    {
+      if (fast[k] == ref[k])
+        {
+          // Dimmed to a quarter, so the differences stand out
+          uint32_t rgb = ref[k] >= maxiters ? 0 : colormap[ref[k]];
+          pixels[k] = (rgb >> 2) & 0x3f3f3f;
+          continue;
+        }
+      unsigned delta = fast[k] > ref[k] ? fast[k] - ref[k] : ref[k] - fast[k];
+      unsigned v = 64 + (unsigned) (191 * log2(delta + 1.0) * scale / 255);
+      if (v > 255) v = 255;
+      pixels[k] = fast[k] > ref[k] ? v << 16 : (v << 8) | v;
+    }
+
+  FILE * f = fopen(path, "wb");
+  int failed = f == NULL || palette_write_ppm(f, pixels, WIDTH, HEIGHT);
+  if (f && fclose(f)) failed = 1;
+  free(pixels);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,559 @@
+/*
+  juliafarm
+  Renders one big image by handing tiles out to worker processes, on
+  this machine or on others
+
+  USAGE:
+  juliafarm [options] [LEFTX TOPY RIGHTX BOTTOMY]
+    Runs the coordinator, rendering the given region (the default
+    Mandelbrot or Julia region otherwise).
+    -w WIDTH -h HEIGHT  image size (default 4096x4096)
+    -s TILE             tile side (default 256)
+    -i MAXITERS         iteration budget (picked from a preview otherwise)
+    -j CR,CI            render the Julia set for c instead of the Mandelbrot
+    -p PORT             port to listen on (default 7337)
+    -l N                start N workers on this machine as well
+    -o FILE             output PPM (default juliafarm.ppm)
+  juliafarm worker HOST [PORT]
+    Runs a worker for the coordinator at HOST.
+
+  The coordinator first renders a small preview of the whole image. That
+  picks the budget, and the preview's iteration counts over each tile
+  are that tile's cost estimate. Tiles go out dearest first so the cheap
+  ones fill in the gaps at the end. Once nothing is left to hand out,
+  idle workers get a second copy of any tile running well past what its
+  cost estimate says it should take, and whichever copy finishes first
+  wins. Tiles held by a worker that goes away go back in the queue.
+
+  Messages are fixed-size structs in native byte order, so every
+  machine in the farm must share an architecture.
+*/
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "iterbuf.h"
+#include "palette.h"
+
+#define FARM_MAGIC (0x4d52464a) // "JFRM"
+
+/* Coordinator to worker: render this tile */
+typedef struct
+{
+  unsigned magic;
+  unsigned kind;
+  int full_w, full_h;
+  unsigned maxiters;
+  unsigned kernel;      // an iterbuf_kernel, the same for every tile
+  int tile;
+  int x, y, w, h;
+  complex_region region;
+  complex c;
+}
+tile_job;
+
+/* Worker to coordinator, followed by w*h iteration counts */
+typedef struct
+{
+  unsigned magic;
+  int tile;
+  int w, h;
+}
+tile_result;
+
+typedef enum
+{
+  TILE_PENDING,
+  TILE_RUNNING,
+  TILE_DONE
+}
+tile_state;
+
+typedef struct
+{
+  int x, y, w, h;
+  double cost;          // estimated from the preview
+  tile_state state;
+  int copies;           // workers currently on it
+  double started;       // when the first running copy went out
+}
+tile;
+
+typedef struct
+{
+  int fd;
+  int tile;             // -1 when idle
+  double started;
+}
+worker;
+
+/* Farm parameters */
+#define DEFAULT_SIDELENGTH (4096)
+#define DEFAULT_TILE (256)
+#define DEFAULT_PORT (7337)
+#define DEFAULT_MAXITERS (255)
+#define PREVIEW_SIDELENGTH (256)
+#define MAX_WORKERS (256)
+// A tile is a straggler once it has taken this many times its estimate
+#define STRAGGLER_FACTOR (3.0)
+#define STRAGGLER_SLACK (0.25)
+
+int RGB_PERIOD = 10;
+
+/* Function prototypes */
+int run_worker(const char * host, const char * port);
+int run_coordinator(tile_job job, int tileside, int port,
+                    int local_workers, const char * outfile);
+void estimate_costs(const tile_job * job, tile * tiles, int ntiles,
+                    int tileside, unsigned * maxiters, unsigned * kernel);
+double now(void);
+
+/* Main Function */
+int main (int argc, char * argv[])
+{
+  if (argc >= 3 && !strcmp(argv[1], "worker"))
+    return run_worker(argv[2], argc >= 4 ? argv[3] : NULL);
+
+  tile_job job;
+  memset(&job, 0, sizeof job);
+  job.magic = FARM_MAGIC;
+  job.kind = ITERBUF_MANDELBROT;
+  job.full_w = DEFAULT_SIDELENGTH;
+  job.full_h = DEFAULT_SIDELENGTH;
+  int tileside = DEFAULT_TILE;
+  int port = DEFAULT_PORT;
+  int local_workers = 0;
+  const char * outfile = "juliafarm.ppm";
+
+  /* Fetch commandline arguments */
+  int opt;
+  while ((opt = getopt(argc, argv, "w:h:s:i:j:p:l:o:")) != -1)
+    switch (opt)
+      {
+      case 'w': job.full_w = atoi(optarg); break;
+      case 'h': job.full_h = atoi(optarg); break;
+      case 's': tileside = atoi(optarg); break;
+      case 'i': job.maxiters = atoi(optarg); break;
+      case 'p': port = atoi(optarg); break;
+      case 'l': local_workers = atoi(optarg); break;
+      case 'o': outfile = optarg; break;
+      case 'j':
+        if (sscanf(optarg, "%lf,%lf", &job.c.r, &job.c.i) != 2)
+          { fprintf(stderr,"-j wants CR,CI\n"); return -1; }
+        job.kind = ITERBUF_JULIA;
+        break;
+      default:
+        fprintf(stderr,"See the top of juliafarm.c for usage\n");
+        return -1;
+      }
+  if (job.full_w <= 0 || job.full_h <= 0 || tileside <= 0 ||
+      local_workers < 0 || local_workers > MAX_WORKERS ||
+      (job.maxiters && job.maxiters < 2))
+    { fprintf(stderr,"Bad size, tile, budget or worker count\n"); return -1; }
+
+  if (optind + 4 <= argc)
+    {
+      job.region.topleft.r = atof(argv[optind]);
+      job.region.topleft.i = atof(argv[optind + 1]);
+      job.region.bottomright.r = atof(argv[optind + 2]);
+      job.region.bottomright.i = atof(argv[optind + 3]);
+    }
+  else if (job.kind == ITERBUF_JULIA)
+    {
+      complex_region julia_region = JULIA_DEFAULT_REGION;
+      job.region = julia_region;
+    }
+  else
+    {
+      complex_region mandelbrot_region = MANDELBROT_DEFAULT_REGION;
+      job.region = mandelbrot_region;
+    }
+
+  return run_coordinator(job, tileside, port, local_workers, outfile);
+}
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*** Worker ***/
+
+int run_worker(const char * host, const char * port)
+{
+  char portbuf[16];
+  if (port == NULL)
+    {
+      snprintf(portbuf, sizeof portbuf, "%d", DEFAULT_PORT);
+      port = portbuf;
+    }
+
+  struct addrinfo hints, * addrs, * a;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &addrs))
+    { fprintf(stderr,"Can't find %s\n", host); return -1; }
+  int sock = -1;
+  for (a = addrs; a && sock < 0; a = a->ai_next)
+    {
+      sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (sock >= 0 && connect(sock, a->ai_addr, a->ai_addrlen))
+        {
+          close(sock);
+          sock = -1;
+        }
+    }
+  freeaddrinfo(addrs);
+  if (sock < 0)
+    { fprintf(stderr,"Can't reach %s:%s\n", host, port); return -1; }
+  // Results go out as a header then a body; don't let Nagle sit on it
+  int yes = 1;
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+
+  iterbuf buf;
+  memset(&buf, 0, sizeof buf);
+  unsigned * counts = NULL;
+  tile_job job;
+  // The coordinator hanging up is how we learn the image is done
+  while (recv(sock, &job, sizeof job, MSG_WAITALL) == sizeof job)
+    {
+      if (job.magic != FARM_MAGIC || job.w <= 0 || job.h <= 0 ||
+          job.maxiters < 2 || job.kernel > ITERBUF_KERNEL_FIXED)
+        { fprintf(stderr,"Bad job from coordinator\n"); return -1; }
+      if (buf.w != job.w || buf.h != job.h)
+        {
+          free(counts);
+          counts = malloc(sizeof(unsigned) * job.w * job.h);
+          if (counts == NULL || iterbuf_alloc(&buf, job.w, job.h))
+            { fprintf(stderr,"Tile allocation failed\n"); return -1; }
+        }
+      iterbuf_set_window(&buf, job.x, job.y, job.full_w, job.full_h);
+      buf.kernel = job.kernel;
+      iterbuf_render(&buf, job.kind, job.region, job.c, job.maxiters);
+
+      // Counts go over the wire row-major
+      tile_result result = { FARM_MAGIC, job.tile, job.w, job.h };
+      size_t size = sizeof(unsigned) * job.w * job.h;
+      iterbuf_counts(&buf, counts);
+      if (send(sock, &result, sizeof result, MSG_NOSIGNAL) != sizeof result ||
+          send(sock, counts, size, MSG_NOSIGNAL) != (ssize_t) size)
+        { fprintf(stderr,"Lost the coordinator\n"); return -1; }
+    }
+
+  close(sock);
+  iterbuf_free(&buf);
+  free(counts);
+  return 0;
+}
+
+/*** Coordinator ***/
+
+void estimate_costs(const tile_job * job, tile * tiles, int ntiles,
+                    int tileside, unsigned * maxiters, unsigned * kernel)
+{
+  // A small render of the whole image, at the same aspect
+  int pw = job->full_w < PREVIEW_SIDELENGTH ? job->full_w : PREVIEW_SIDELENGTH;
+  int ph = (int) ((double) pw * job->full_h / job->full_w);
+  if (ph < 1) ph = 1;
+  iterbuf preview;
+  memset(&preview, 0, sizeof preview);
+  if (iterbuf_alloc(&preview, pw, ph)) return;
+
+  double base_span = job->kind == ITERBUF_JULIA ?
+    JULIA_BASE_SPAN : MANDELBROT_BASE_SPAN;
+  iterbuf_render(&preview, job->kind, job->region, job->c,
+                 *maxiters ? *maxiters : DEFAULT_MAXITERS);
+  if (*maxiters == 0)
+    {
+      iterbuf_refine(&preview, base_span, NULL, NULL);
+      *maxiters = preview.maxiters;
+    }
+  /* Tiles must agree on the arithmetic or the seams would show, so
+     whatever the preview settled on goes for the whole image. Its
+     pixels are far coarser than the image's, though, so fixed point
+     has to be good enough at full size as well. */
+  iterbuf full = preview;
+  iterbuf_set_window(&full, 0, 0, job->full_w, job->full_h);
+  *kernel = preview.fixed && iterbuf_fixed_permitted(&full) ?
+    ITERBUF_KERNEL_FIXED : ITERBUF_KERNEL_DOUBLE;
+
+  // Each preview pixel stands for a patch of the full image
+  const int tiles_across = (job->full_w + tileside - 1) / tileside;
+  const double patch = ((double) job->full_w / pw) * ((double) job->full_h / ph);
+  int i,j;
+  for (j=0; j<ph; j++)
+    for (i=0; i<pw; i++)
+      {
+        int x = (int) ((double) i * job->full_w / pw);
+        int y = (int) ((double) j * job->full_h / ph);
+        int t = (y / tileside) * tiles_across + x / tileside;
+        if (t < ntiles)
+          tiles[t].cost += patch *
+            (preview.iters[iterbuf_index(&preview, i, j)] + 1);
+      }
+  iterbuf_free(&preview);
+}
+
+static int by_cost(const void * a, const void * b)
+{
+  double ca = ((const tile *) a)->cost, cb = ((const tile *) b)->cost;
+  return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+// Picks what an idle worker should do next, or -1 for nothing yet
+static int next_tile(tile * tiles, int ntiles, double sec_per_cost)
+{
+  int t;
+  for (t=0; t<ntiles; t++)
+    if (tiles[t].state == TILE_PENDING)
+      return t;
+
+  // Nothing left to hand out; back up the worst straggler, if any
+  if (sec_per_cost <= 0) return -1;
+  double when = now();
+  double worst = 0;
+  int pick = -1;
+  for (t=0; t<ntiles; t++)
+    if (tiles[t].state == TILE_RUNNING && tiles[t].copies == 1)
+      {
+        double expected = tiles[t].cost * sec_per_cost;
+        double late = (when - tiles[t].started)
+          / (STRAGGLER_FACTOR * expected + STRAGGLER_SLACK);
+        if (late > 1 && late > worst)
+          {
+            worst = late;
+            pick = t;
+          }
+      }
+  return pick;
+}
+
+static int send_job(worker * w, tile_job job, tile * tiles, int t)
+{
+  job.tile = t;
+  job.x = tiles[t].x;
+  job.y = tiles[t].y;
+  job.w = tiles[t].w;
+  job.h = tiles[t].h;
+  if (send(w->fd, &job, sizeof job, MSG_NOSIGNAL) != sizeof job)
+    return -1;
+
+  w->tile = t;
+  w->started = now();
+  if (tiles[t].copies++ == 0)
+    tiles[t].started = w->started;
+  tiles[t].state = TILE_RUNNING;
+  return 0;
+}
+
+// Forgets a worker, putting its tile back up for grabs
+static void drop_worker(worker * workers, int * nworkers, int k, tile * tiles)
+{
+  int t = workers[k].tile;
+  if (t >= 0 && --tiles[t].copies == 0 && tiles[t].state == TILE_RUNNING)
+    tiles[t].state = TILE_PENDING;
+  close(workers[k].fd);
+  workers[k] = workers[--*nworkers];
+}
+
+int run_coordinator(tile_job job, int tileside, int port,
+                    int local_workers, const char * outfile)
+{
+  signal(SIGPIPE, SIG_IGN);
+
+  /* Cut the image into tiles and cost them out */
+  const int tiles_across = (job.full_w + tileside - 1) / tileside;
+  const int tiles_down = (job.full_h + tileside - 1) / tileside;
+  const int ntiles = tiles_across * tiles_down;
+  tile * tiles = calloc(ntiles, sizeof(tile));
+  unsigned * image = malloc(sizeof(unsigned) * job.full_w * job.full_h);
+  if (tiles == NULL || image == NULL)
+    { fprintf(stderr,"Image allocation failed\n"); return -1; }
+  {
+    int t;
+    for (t=0; t<ntiles; t++)
+      {
+        tiles[t].x = (t % tiles_across) * tileside;
+        tiles[t].y = (t / tiles_across) * tileside;
+        tiles[t].w = job.full_w - tiles[t].x < tileside ?
+          job.full_w - tiles[t].x : tileside;
+        tiles[t].h = job.full_h - tiles[t].y < tileside ?
+          job.full_h - tiles[t].y : tileside;
+      }
+  }
+  estimate_costs(&job, tiles, ntiles, tileside, &job.maxiters, &job.kernel);
+  qsort(tiles, ntiles, sizeof(tile), by_cost);
+  fprintf(stderr,"%dx%d image in %d tiles, maxiters %u, %s arithmetic\n",
+          job.full_w, job.full_h, ntiles, job.maxiters,
+          job.kernel == ITERBUF_KERNEL_FIXED ? "fixed-point" : "double");
+
+  /* Open for business */
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  int yes = 1;
+  if (listener < 0 ||
+      setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) ||
+      bind(listener, (struct sockaddr *) &addr, sizeof addr) ||
+      listen(listener, 16))
+    {
+      fprintf(stderr,"Can't listen on port %d: %s\n", port, strerror(errno));
+      return -1;
+    }
+  fprintf(stderr,"Waiting for workers on port %d\n", port);
+
+  {
+    char portstr[16];
+    snprintf(portstr, sizeof portstr, "%d", port);
+    int i;
+    for (i=0; i<local_workers; i++)
+      if (fork() == 0)
+        {
+          close(listener);
+          exit(run_worker("127.0.0.1", portstr) ? 1 : 0);
+        }
+  }
+
+  /* Hand out tiles until every one is back */
+  worker workers[MAX_WORKERS];
+  int nworkers = 0;
+  int done = 0;
+  double done_cost = 0, done_seconds = 0;
+  const double start = now();
+  while (done < ntiles)
+    {
+      // Give every idle worker something to do
+      double sec_per_cost = done_cost > 0 ? done_seconds / done_cost : 0;
+      int k;
+      for (k=0; k<nworkers; k++)
+        if (workers[k].tile < 0)
+          {
+            int t = next_tile(tiles, ntiles, sec_per_cost);
+            if (t < 0) break;
+            if (tiles[t].state == TILE_RUNNING)
+              fprintf(stderr,"  tile %d is straggling; sending a backup\n", t);
+            if (send_job(&workers[k], job, tiles, t))
+              drop_worker(workers, &nworkers, k--, tiles);
+          }
+
+      struct pollfd fds[MAX_WORKERS + 1];
+      fds[0].fd = listener;
+      fds[0].events = POLLIN;
+      for (k=0; k<nworkers; k++)
+        {
+          fds[k + 1].fd = workers[k].fd;
+          fds[k + 1].events = POLLIN;
+        }
+      // Wake up now and then to look for stragglers
+      if (poll(fds, nworkers + 1, 100) < 0 && errno != EINTR)
+        { fprintf(stderr,"Poll failed\n"); return -1; }
+
+      // Results first, since dropping workers reshuffles the list
+      for (k=nworkers-1; k>=0; k--)
+        {
+          if (!(fds[k + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+          worker * w = &workers[k];
+          tile_result result;
+          int t = w->tile;
+          if (t < 0 ||
+              recv(w->fd, &result, sizeof result, MSG_WAITALL) != sizeof result ||
+              result.magic != FARM_MAGIC || result.tile != t ||
+              result.w != tiles[t].w || result.h != tiles[t].h)
+            {
+              drop_worker(workers, &nworkers, k, tiles);
+              continue;
+            }
+
+          // Rows land straight in the image, unless a backup beat us
+          unsigned * row = malloc(sizeof(unsigned) * result.w);
+          int j, ok = row != NULL;
+          for (j=0; ok && j<result.h; j++)
+            {
+              ssize_t size = sizeof(unsigned) * result.w;
+              ok = recv(w->fd, row, size, MSG_WAITALL) == size;
+              if (ok && tiles[t].state != TILE_DONE)
+                memcpy(image + (size_t) (tiles[t].y + j) * job.full_w
+                       + tiles[t].x, row, size);
+            }
+          free(row);
+          if (!ok)
+            {
+              drop_worker(workers, &nworkers, k, tiles);
+              continue;
+            }
+
+          tiles[t].copies--;
+          if (tiles[t].state != TILE_DONE)
+            {
+              tiles[t].state = TILE_DONE;
+              done++;
+              done_cost += tiles[t].cost;
+              done_seconds += now() - w->started;
+            }
+          w->tile = -1;
+        }
+
+      if (fds[0].revents & POLLIN)
+        {
+          int fd = accept(listener, NULL, NULL);
+          if (fd >= 0 && nworkers < MAX_WORKERS)
+            {
+              setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof yes);
+              workers[nworkers].fd = fd;
+              workers[nworkers].tile = -1;
+              nworkers++;
+            }
+          else if (fd >= 0)
+            close(fd);
+        }
+    }
+  fprintf(stderr,"All %d tiles back in %.2fs\n", ntiles, now() - start);
+
+  // Hanging up tells the workers we're done
+  {
+    int k;
+    for (k=0; k<nworkers; k++)
+      close(workers[k].fd);
+    close(listener);
+    while (local_workers-- > 0)
+      wait(NULL);
+  }
+
+  /* Assemble the output; the image is row-major, straight off the wire */
+  uint32_t * colormap = palette_build(job.maxiters + 1, RGB_PERIOD);
+  uint32_t * pixels = malloc(sizeof(uint32_t) * job.full_w * job.full_h);
+  if (colormap == NULL || pixels == NULL)
+    { fprintf(stderr,"Output allocation failed\n"); return -1; }
+  {
+    size_t k;
+    for (k=0; k<(size_t) job.full_w * job.full_h; k++)
+      pixels[k] = image[k] >= job.maxiters ? 0 : colormap[image[k]];
+  }
+
+  FILE * f = fopen(outfile, "wb");
+  if (f == NULL)
+    { fprintf(stderr,"Can't open %s\n", outfile); return -1; }
+  int failed = palette_write_ppm(f, pixels, job.full_w, job.full_h);
+  if (fclose(f)) failed = -1;
+  if (failed)
+    { fprintf(stderr,"Write to %s failed\n", outfile); return -1; }
+  fprintf(stderr,"Wrote %s\n", outfile);
+  return 0;
+}
@@ -6,19 +6,22 @@
   Can be called with no arguments
   juliapreview LEFTX TOPY RIGHTX BOTTOMY will set the Mandelbrot's region
   to the given coordinates
+  Press b to swap the Mandelbrot for its orbit density (Buddhabrot),
+  which keeps sharpening for as long as it is left up
+  The arrow keys pan the Mandelbrot, Page Up and Page Down zoom it in
+  and out, and Home goes back to where it started
 */
 
 #include <SDL/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "buddha.h"
 #include "complex.h"
-
-typedef struct
-{
-  complex topleft;
-  complex bottomright;
-}
-complex_region;
+#include "iterbuf.h"
+#include "pyramid.h"
+#include "renderclient.h"
+#include "sdlpanel.h"
 
 /* Screen parameters */
 #define DEFAULT_HEIGHT (350)
@@ -31,44 +34,52 @@ SDL_Rect mandelbrot_screen;
 SDL_Rect julia_screen;
 
 /* Rendering parameters */
-const Uint32 MAXITERS = 255;
-complex_region mandelbrot_region =
-  {
-    {-2, 1.5},
-    {1, -1.5}
-  };
-complex_region julia_region =
-  {
-    {-2,2},
-    {2,-2}
-  };
+// Budget for the first frame; later frames pick their own from the last one
+#define DEFAULT_MAXITERS (255)
+complex_region mandelbrot_region = MANDELBROT_DEFAULT_REGION;
+complex_region julia_region = JULIA_DEFAULT_REGION;
+iterbuf julia_buf;
+// The Mandelbrot is drawn from tiles, so places already seen come back
+// for free; its region follows wherever the view has been moved
+pyramid mandelbrot_pyramid;
+pyramid_view mandelbrot_view;
+
+/* Buddhabrot parameters */
+#define BUDDHA_MAXITERS (1000)
+#define BUDDHA_THREADS (4)
+// Samples between screen updates
+#define BUDDHA_BATCH (100000)
+int buddha_mode = 0;
+buddha mandelbrot_buddha;
+Uint32 buddha_ramp[256];
 
 /* Visualization parameters */
-int RGB_PERIOD = 10;
+#define RGB_PERIOD (10)
+sdlpanel_colormap colormap = { NULL, 0, RGB_PERIOD };
 
 /* Function prototypes */
 int configure_video(int width, int height);
 int inbounds(int x, int y)
 {return (x < WIDTH && y < HEIGHT && x >= 0 && y >= 0);}
 
-void putPixel(SDL_Surface * screen, int x, int y, Uint32 color);
-
-Uint32 visualize_rgb(Uint32 iters, Uint32 period, Uint32 maxiters);
-
-/* Draws the mandelbrot onscreen using the given colormap */
-void draw_mandelbrot(SDL_Surface * screen,
-                     complex_region region, SDL_Rect screen_region,
-                     Uint32 * colormap,
-                     unsigned maxiters);
-unsigned mandelbrot_iterate(complex c, unsigned maxiters);
-/* Draws the Julia onscreen using the given colormap */
+/* Draws the mandelbrot onscreen from the tile pyramid, showing what is
+   already there before filling in the rest */
+void draw_mandelbrot(SDL_Surface * screen, SDL_Rect screen_region,
+                     pyramid * p, const pyramid_view * view);
+// Zooms the Mandelbrot by whole levels and pans it by pixels, then redraws
+void move_mandelbrot(int zoom, long dx, long dy);
+/* Draws the Julia onscreen, same deal */
 void draw_julia(SDL_Surface * screen,
                 complex_region region, SDL_Rect screen_region,
-                Uint32 * colormap,
+                iterbuf * buf,
                 unsigned maxiters,
                 complex c);
-unsigned julia_iterate(complex z, const complex c, double escape,
-                       unsigned maxiters);
+// Colors whatever the pyramid has of a view into its part of the screen
+void show_pyramid(SDL_Surface * screen, pyramid * p,
+                  const pyramid_view * view, SDL_Rect screen_region);
+/* Adds a batch of samples to the Buddhabrot and shows the result */
+void draw_buddha(SDL_Surface * screen, buddha * b,
+                 complex_region region, SDL_Rect screen_region);
 
 double linmap(double x1, double y1, double x2, double y2, double xt);
 
@@ -107,35 +118,47 @@ int main (int argc, char * argv[])
   /*** Our initialization stuff ***/
   fprintf(stderr,"Now setting up fractal things\n");
   // Fill out the colormap array
-  Uint32 colormap[MAXITERS];
+  if (sdlpanel_grow_colormap(&colormap, screen->format, DEFAULT_MAXITERS))
+    { fprintf(stderr,"Colormap allocation failed\n"); return -1; };
+  // Anchor the tile pyramid to the starting view, one pixel per pixel
   {
-    unsigned i;
-    for (i=0; i<=MAXITERS; i++)
-      {
-        colormap[i] =
-          visualize_rgb(i, RGB_PERIOD, MAXITERS);
-      }
+    complex tile_span;
+    tile_span.r = (mandelbrot_region.bottomright.r - mandelbrot_region.topleft.r)
+      * PYRAMID_TILE / mandelbrot_screen.w;
+    tile_span.i = (mandelbrot_region.bottomright.i - mandelbrot_region.topleft.i)
+      * PYRAMID_TILE / mandelbrot_screen.h;
+    if (pyramid_init(&mandelbrot_pyramid, mandelbrot_region.topleft, tile_span,
+                     MANDELBROT_BASE_SPAN * PYRAMID_TILE / mandelbrot_screen.w,
+                     DEFAULT_MAXITERS, PYRAMID_BYTES))
+      { fprintf(stderr,"Tile cache allocation failed\n"); return -1; };
+    mandelbrot_view.level = 0;
+    mandelbrot_view.x = mandelbrot_view.y = 0;
+    mandelbrot_view.w = mandelbrot_screen.w;
+    mandelbrot_view.h = mandelbrot_screen.h;
   }
   // Draw the mandelbrot
   {
     fprintf(stderr,"Rendering mandelbrot...\n");
     Uint32 start = SDL_GetTicks();
-    draw_mandelbrot(screen, mandelbrot_region, mandelbrot_screen,
-                    colormap, MAXITERS);
+    draw_mandelbrot(screen, mandelbrot_screen,
+                    &mandelbrot_pyramid, &mandelbrot_view);
     Uint32 stop = SDL_GetTicks();
-    fprintf(stderr,"  Mandelbrot took %lums\n", (long unsigned) stop - start);
+    fprintf(stderr,"  Mandelbrot took %lums (maxiters %u)\n",
+            (long unsigned) stop - start, mandelbrot_pyramid.maxiters);
   }
   // Assign a c and render an initial Julia
   complex c = {.233, .53780};
   fprintf(stderr,"Rendering initial Julia\n");
-  draw_julia(screen, julia_region, julia_screen, colormap, MAXITERS, c);
+  draw_julia(screen, julia_region, julia_screen, &julia_buf,
+             DEFAULT_MAXITERS, c);
 
   fprintf(stderr,"Entering main loop\n");
   // main loop!
   while(1)
     {
-      // Wait for an event
-      SDL_WaitEvent(NULL);
+      // Wait for an event, unless there's a Buddhabrot to work on
+      if (!buddha_mode)
+        SDL_WaitEvent(NULL);
 
       // handle events
       SDL_Event event;
@@ -150,11 +173,15 @@ int main (int argc, char * argv[])
                   fprintf(stderr,"Error on video reconfigure! Quitting...\n");
                   return -1;
                 }
-              // Redraw the Mandelbrot and current Julia in their new regions
-              draw_mandelbrot(screen, mandelbrot_region, mandelbrot_screen,
-                              colormap, MAXITERS);
-              draw_julia(screen, julia_region, julia_screen,
-                         colormap, MAXITERS, c);
+              // The Mandelbrot keeps its scale and shows more or less of
+              // the plane; the Julia is stretched to its new panel
+              mandelbrot_view.w = mandelbrot_screen.w;
+              mandelbrot_view.h = mandelbrot_screen.h;
+              move_mandelbrot(0, 0, 0);
+              draw_julia(screen, julia_region, julia_screen, &julia_buf,
+                         iterbuf_suggest_maxiters(&julia_buf,
+                                                  JULIA_BASE_SPAN),
+                         c);
               break;
             case SDL_KEYDOWN:
               switch(event.key.keysym.sym)
@@ -162,6 +189,37 @@ int main (int argc, char * argv[])
                 case SDLK_ESCAPE:
                   return 0;
                   break;
+                case SDLK_b:
+                  buddha_mode = !buddha_mode;
+                  if (!buddha_mode)
+                    draw_mandelbrot(screen, mandelbrot_screen,
+                                    &mandelbrot_pyramid, &mandelbrot_view);
+                  break;
+                case SDLK_LEFT:
+                  move_mandelbrot(0, -mandelbrot_view.w / 4, 0);
+                  break;
+                case SDLK_RIGHT:
+                  move_mandelbrot(0, mandelbrot_view.w / 4, 0);
+                  break;
+                case SDLK_UP:
+                  move_mandelbrot(0, 0, -mandelbrot_view.h / 4);
+                  break;
+                case SDLK_DOWN:
+                  move_mandelbrot(0, 0, mandelbrot_view.h / 4);
+                  break;
+                case SDLK_PAGEUP:
+                  move_mandelbrot(1, 0, 0);
+                  break;
+                case SDLK_PAGEDOWN:
+                  move_mandelbrot(-1, 0, 0);
+                  break;
+                case SDLK_HOME:
+                  mandelbrot_view.level = 0;
+                  mandelbrot_view.x = mandelbrot_view.y = 0;
+                  move_mandelbrot(0, 0, 0);
+                  break;
+                default:
+                  break;
                 }
               break;
             case SDL_QUIT:
@@ -193,8 +251,11 @@ int main (int argc, char * argv[])
                              mandelbrot_screen.y+mandelbrot_screen.h,
                              mandelbrot_region.bottomright.i,
                              y);
-                draw_julia(screen, julia_region, julia_screen,
-                           colormap, MAXITERS, c);
+                // Budget comes from how the previous Julia turned out
+                draw_julia(screen, julia_region, julia_screen, &julia_buf,
+                           iterbuf_suggest_maxiters(&julia_buf,
+                                                    JULIA_BASE_SPAN),
+                           c);
               } // Left mouse button action
 
           } // In the mandelbrot region?
@@ -203,6 +264,10 @@ int main (int argc, char * argv[])
             zoom_selecting = 0;
           }
       } // Mouse state reading block
+
+      if (buddha_mode)
+        draw_buddha(screen, &mandelbrot_buddha, mandelbrot_region,
+                    mandelbrot_screen);
     } // main loop
   return 0;
 }
@@ -246,140 +311,132 @@ int configure_video(int width, int height)
   return 0;
 };
 
-void putPixel(SDL_Surface * screen, int x, int y, Uint32 color)
-{
-  //  fprintf(stderr," %x@%d,%d", color, x, y);
-  unsigned int offset =
-    x + (screen->pitch >> 2) * y;
-  ((Uint32 *) screen->pixels)[offset] = color;
-}
-
-Uint32 visualize_rgb(Uint32 iters, Uint32 period, Uint32 maxiters)
+void show_pyramid(SDL_Surface * screen, pyramid * p,
+                  const pyramid_view * view, SDL_Rect screen_region)
 {
-  // Non-escaping values are black
-  if (iters >= maxiters)
-    return SDL_MapRGB(screen->format, 0, 0, 0);
-
-  iters %= (period * 3);
-  Uint32 value =
-    (iters % period) * 255 / period;
-  if (iters >= (period * 2))
-    return SDL_MapRGB(screen->format, value, 0, 0);
-  else if (iters >= period)
-    return SDL_MapRGB(screen->format, 0, value, 0);
-  else
-    return SDL_MapRGB(screen->format, 0, 0, value);
-}
+  if (sdlpanel_grow_colormap(&colormap, screen->format, p->maxiters))
+    return;
 
-void draw_mandelbrot(SDL_Surface * screen,
-                     complex_region region, SDL_Rect screen_region,
-                     Uint32 * colormap,
-                     unsigned maxiters)
-{
   // lock teh surface
   if (SDL_MUSTLOCK(screen))
     if (SDL_LockSurface(screen) < 0) return;
 
-  int i,j;
-  for (j=0; j<screen_region.h; j++)
-    {
-      complex c = {0,0};
-      c.i = region.topleft.i +
-        (region.bottomright.i - region.topleft.i) * j / screen_region.h;
-
-      for (i=0; i<screen_region.w; i++)
-        {
-          c.r =
-            region.topleft.r +
-            (region.bottomright.r - region.topleft.r) * i / screen_region.w;
-          unsigned iters = mandelbrot_iterate(c, maxiters);
-          //      fprintf(stderr,"%lf,%lf=%u(%lu) ", c.r, c.i, iters,colormap[iters]);
-          Uint32 color =
-            colormap[iters];
-          putPixel(screen, screen_region.x + i, screen_region.y + j, color);
-        }
-      //      putchar('\n');
-    }
+  pyramid_paint(p, view, colormap.colors,
+                SDL_MapRGB(screen->format, 0, 0, 0),
+                (Uint32 *) screen->pixels
+                + screen_region.x + (screen->pitch >> 2) * screen_region.y,
+                screen->pitch >> 2);
 
   // unlock teh surface
   if (SDL_MUSTLOCK(screen))
     SDL_UnlockSurface(screen);
 
   // update!
-  /*SDL_UpdateRect(screen,
-    screen_region.x, screen_region.y,
-    screen_region.w, screen_region.h);*/
-  //  SDL_UpdateRect(screen, 0,0,0,0);
   SDL_UpdateRects(screen, 1, &screen_region);
-
-
 }
 
-unsigned iterate(complex z, complex c, unsigned maxiters)
+void draw_mandelbrot(SDL_Surface * screen, SDL_Rect screen_region,
+                     pyramid * p, const pyramid_view * view)
 {
-  unsigned iters = 0;
-
-  while (++iters < maxiters && complex_sqmag(z) <= 4)
-    z = complex_add(complex_mult(z, z), c);
-
-  return iters;
+  // Tiles on hand go up at once, with ancestors standing in for the rest
+  show_pyramid(screen, p, view, screen_region);
+  if (pyramid_render_view(p, view) == 0)
+    {
+      fprintf(stderr,"  Mandelbrot tile allocation failed\n");
+      return;
+    }
+  show_pyramid(screen, p, view, screen_region);
 }
 
-unsigned mandelbrot_iterate(complex c, unsigned maxiters)
+void move_mandelbrot(int zoom, long dx, long dy)
 {
-  complex z = {0,0};
-  return iterate(z,c, maxiters);
+  pyramid_zoom(&mandelbrot_view, zoom);
+  mandelbrot_view.x += dx;
+  mandelbrot_view.y += dy;
+  mandelbrot_region = pyramid_view_region(&mandelbrot_pyramid,
+                                          &mandelbrot_view);
+  // The Buddhabrot notices the new region on its next batch
+  if (!buddha_mode)
+    draw_mandelbrot(screen, mandelbrot_screen,
+                    &mandelbrot_pyramid, &mandelbrot_view);
 }
 
-
 void draw_julia(SDL_Surface * screen,
                 complex_region region, SDL_Rect screen_region,
-                Uint32 * colormap,
+                iterbuf * buf,
                 unsigned maxiters,
                 complex c)
 {
-  printf("c=(%lf,%lf)\n", c.r, c.i);
-  // lock teh surface
-  if (SDL_MUSTLOCK(screen))
-    if (SDL_LockSurface(screen) < 0) return;
+  sdlpanel panel = { screen, screen_region, &colormap, 1 };
+  printf("c=(%lf,%lf) maxiters=%u\n", c.r, c.i, maxiters);
+  /* Only what the server has finished: its renders come whole, and a
+     panel rendered here goes up tile by tile from the pointer out */
+  if (!renderclient_lookup(buf, ITERBUF_JULIA, region, c,
+                           screen_region.w, screen_region.h, maxiters))
+    {
+      sdlpanel_show(&panel, buf);
+      return;
+    }
 
-  int i,j;
-  for (j=0; j<screen_region.h; j++)
+  if (buf->w != screen_region.w || buf->h != screen_region.h)
+    if (iterbuf_alloc(buf, screen_region.w, screen_region.h)) return;
+
+  /* Start wherever the pointer is on the Julia panel. Otherwise it's
+     out dragging over the Mandelbrot, and the eye goes to the middle
+     of the new Julia first. */
+  int fx, fy;
+  SDL_GetMouseState(&fx, &fy);
+  fx -= screen_region.x;
+  fy -= screen_region.y;
+  if (fx < 0 || fy < 0 || fx >= screen_region.w || fy >= screen_region.h)
     {
-      complex z = {0,0};
-      z.i = region.topleft.i +
-        (region.bottomright.i - region.topleft.i) * j / screen_region.h;
+      fx = screen_region.w / 2;
+      fy = screen_region.h / 2;
+    }
+
+  // Every tile of the render, then of each extension, goes up as soon
+  // as it's done, nearest the focus first
+  iterbuf_render_focused(buf, ITERBUF_JULIA, region, c, maxiters, fx, fy,
+                         sdlpanel_show_part, &panel);
+  iterbuf_refine_focused(buf, JULIA_BASE_SPAN, fx, fy,
+                         sdlpanel_show_part, &panel);
+}
 
-      for (i=0; i<screen_region.w; i++)
+void draw_buddha(SDL_Surface * screen, buddha * b,
+                 complex_region region, SDL_Rect screen_region)
+{
+  // Start over if the panel changed size or moved
+  if (b->w != screen_region.w || b->h != screen_region.h ||
+      memcmp(&b->region, &region, sizeof region))
+    {
+      buddha_free(b);
+      if (buddha_init(b, screen_region.w, screen_region.h, region,
+                      BUDDHA_MAXITERS, BUDDHA_THREADS))
         {
-          z.r =
-            region.topleft.r +
-            (region.bottomright.r - region.topleft.r) * i / screen_region.w;
-          unsigned iters = julia_iterate(z,c,2, maxiters);
-          //      fprintf(stderr,"%lf,%lf=%u(%lu) ", c.r, c.i, iters,colormap[iters]);
-          Uint32 color =
-            colormap[iters];
-          putPixel(screen, screen_region.x + i, screen_region.y + j, color);
+          fprintf(stderr,"Buddhabrot allocation failed\n");
+          buddha_mode = 0;
+          return;
         }
-      //      putchar('\n');
+      unsigned i;
+      for (i=0; i<256; i++)
+        buddha_ramp[i] = SDL_MapRGB(screen->format, i, i, i);
     }
 
+  buddha_sample(b, BUDDHA_BATCH);
+
+  // lock teh surface
+  if (SDL_MUSTLOCK(screen))
+    if (SDL_LockSurface(screen) < 0) return;
+
+  buddha_colorize(b, buddha_ramp,
+                  (Uint32 *) screen->pixels
+                  + screen_region.x + (screen->pitch >> 2) * screen_region.y,
+                  screen->pitch >> 2);
+
   // unlock teh surface
   if (SDL_MUSTLOCK(screen))
     SDL_UnlockSurface(screen);
 
   // update!
-  /*  SDL_UpdateRect(screen,
-      screen_region.x, screen_region.y,
-      screen_region.w, screen_region.h);*/
-  //  SDL_UpdateRect(screen, 0,0,0,0);
   SDL_UpdateRects(screen, 1, &screen_region);
-
-
-}
-
-unsigned julia_iterate(complex z, const complex c, double escape,
-                       unsigned maxiters)
-{
-  return iterate(z,c, maxiters);
 }
@@ -1,13 +1,11 @@
 #include <SDL/SDL.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "complex.h"
-
-typedef struct
-{
-  complex topleft;
-  complex bottomright;
-}
-complex_region;
+#include "iterbuf.h"
+#include "itercache.h"
+#include "renderclient.h"
+#include "sdlpanel.h"
 
 /* Screen parameters */
 /*
@@ -34,20 +32,16 @@ SDL_Surface * mandelbrot_screen = NULL;
 SDL_Surface * julia_screen = NULL;
 
 /* Rendering parameters */
-const Uint32 MAXITERS = 255;
-const complex_region mandelbrot_region =
-  {
-    {-2, 1.5},
-    {1, -1.5}
-  };
-complex_region julia_region =
-  {
-    {-2,2},
-    {2,-2}
-  };
+// Budget for the first frame; later frames pick their own from the last one
+#define DEFAULT_MAXITERS (255)
+const complex_region mandelbrot_region = MANDELBROT_DEFAULT_REGION;
+complex_region julia_region = JULIA_DEFAULT_REGION;
+iterbuf mandelbrot_buf;
+iterbuf julia_buf;
 
 /* Visualization parameters */
-int RGB_PERIOD = 10;
+#define RGB_PERIOD (10)
+sdlpanel_colormap colormap = { NULL, 0, RGB_PERIOD };
 
 /* Function prototypes */
 int configure_video(int width, int height);
@@ -58,24 +52,18 @@ int build_overlay(SDL_Surface * display, SDL_Surface * solid,
 int inbounds(int x, int y)
 {return (x < SIDELENGTH && y < SIDELENGTH && x >= 0 && y >= 0);}
 
-void putPixel(SDL_Surface * screen, int x, int y, Uint32 color);
-
-Uint32 visualize_rgb(Uint32 iters, Uint32 period, Uint32 maxiters);
-
-/* Draws the mandelbrot onscreen using the given colormap */
+/* Draws the mandelbrot onscreen, starting at the given budget and
+   raising it while the picture still needs more */
 void draw_mandelbrot(SDL_Surface * screen,
 		     complex_region region, SDL_Rect screen_region,
-		     Uint32 * colormap,
+		     iterbuf * buf,
 		     unsigned maxiters);
-unsigned mandelbrot_iterate(complex c, unsigned maxiters);
-/* Draws the Julia onscreen using the given colormap */
+/* Draws the Julia onscreen, same deal */
 void draw_julia(SDL_Surface * screen,
 		complex_region region, SDL_Rect screen_region,
-		Uint32 * colormap,
+		iterbuf * buf,
 		unsigned maxiters,
 		complex c);
-unsigned julia_iterate(complex z, const complex c, double escape,
-		       unsigned maxiters);
 
 /* Main Function */
 int main ()
@@ -97,28 +85,23 @@ int main ()
   /*** Our initialization stuff ***/
   fprintf(stderr, "Now setting up fractal things\n");
   // Fill out the colormap array
-  Uint32 colormap[MAXITERS];
-  {
-    unsigned i;
-    for (i=0; i<=MAXITERS; i++)
-      {
-	colormap[i] =
-	  visualize_rgb(i, RGB_PERIOD, MAXITERS);
-      }
-  }
+  if (sdlpanel_grow_colormap(&colormap, screen->format, DEFAULT_MAXITERS))
+    { fprintf(stderr, "Colormap allocation failed\n"); return -1; };
   // Draw the mandelbrot
   {
     fprintf(stderr, "Rendering mandelbrot...\n");
     Uint32 start = SDL_GetTicks();
     draw_mandelbrot(mandelbrot_screen, mandelbrot_region, render_rect,
-		    colormap, MAXITERS);
+		    &mandelbrot_buf, DEFAULT_MAXITERS);
     Uint32 stop = SDL_GetTicks();
-    fprintf(stderr, "  Mandelbrot took %lums\n", (long unsigned) stop - start);
+    fprintf(stderr, "  Mandelbrot took %lums (maxiters %u)\n",
+	    (long unsigned) stop - start, mandelbrot_buf.maxiters);
   }
   // Assign a c and render an initial Julia
   complex c = {.233, .53780};
   fprintf(stderr, "Rendering initial Julia\n");
-  draw_julia(julia_screen, julia_region, render_rect, colormap, MAXITERS, c);
+  draw_julia(julia_screen, julia_region, render_rect, &julia_buf,
+	     DEFAULT_MAXITERS, c);
   // Construct the initial visual
   if (build_overlay(screen, julia_screen,
 		    mandelbrot_screen, &render_rect))
@@ -150,9 +133,10 @@ int main ()
 	      // Redraw the Mandelbrot and current Julia in their new regions
 	      draw_mandelbrot(mandelbrot_screen, mandelbrot_region,
 			      render_rect,
-			      colormap, MAXITERS);
-	      draw_julia(julia_screen, julia_region, render_rect,
-			 colormap, MAXITERS, c);
+			      &mandelbrot_buf, DEFAULT_MAXITERS);
+	      draw_julia(julia_screen, julia_region, render_rect, &julia_buf,
+			 iterbuf_suggest_maxiters(&julia_buf, JULIA_BASE_SPAN),
+			 c);
 	      if (build_overlay(screen, julia_screen,
 				mandelbrot_screen, &render_rect))
 		{
@@ -195,8 +179,11 @@ int main ()
 		  (mandelbrot_region.bottomright.i
 		   - mandelbrot_region.topleft.i) /
 		  render_rect.h;
-		draw_julia(julia_screen, julia_region, render_rect,
-			   colormap, MAXITERS, c);
+		// Budget comes from how the previous Julia turned out
+		draw_julia(julia_screen, julia_region, render_rect, &julia_buf,
+			   iterbuf_suggest_maxiters(&julia_buf,
+						    JULIA_BASE_SPAN),
+			   c);
 		if (build_overlay(screen, julia_screen,
 				  mandelbrot_screen, &render_rect))
 		  {
@@ -260,139 +247,62 @@ int build_overlay(SDL_Surface * display, SDL_Surface * solid,
   return 0;
 }
 
-void putPixel(SDL_Surface * screen, int x, int y, Uint32 color)
-{
-  //  fprintf(stderr, " %x@%d,%d", color, x, y);
-  unsigned int offset =
-    x + (screen->pitch >> 2) * y;
-  ((Uint32 *) screen->pixels)[offset] = color;
-}
-
-Uint32 visualize_rgb(Uint32 iters, Uint32 period, Uint32 maxiters)
-{
-  // Non-escaping values are black
-  if (iters >= maxiters)
-    return SDL_MapRGB(screen->format, 0, 0, 0);
-
-  iters %= (period * 3);
-  Uint32 value = 
-    (iters % period) * 255 / period;
-  if (iters >= (period * 2))
-    return SDL_MapRGB(screen->format, value, 0, 0);
-  else if (iters >= period)
-    return SDL_MapRGB(screen->format, 0, value, 0);
-  else
-    return SDL_MapRGB(screen->format, 0, 0, value);
-}
-
 void draw_mandelbrot(SDL_Surface * screen,
 		     complex_region region, SDL_Rect screen_region,
-		     Uint32 * colormap,
+		     iterbuf * buf,
 		     unsigned maxiters)
 {
-  // lock teh surface
-  if (SDL_MUSTLOCK(screen))
-    if (SDL_LockSurface(screen) < 0) return;
-    
-  int i,j;
-  for (j=0; j<screen_region.h; j++)
-    {
-      complex c = {0,0};
-      c.i = region.topleft.i +
-	(region.bottomright.i - region.topleft.i) * j / screen_region.h;
+  // Offscreen; build_overlay puts it on the display
+  sdlpanel panel = { screen, screen_region, &colormap, 0 };
 
-      for (i=0; i<screen_region.w; i++)
-	{
-	  c.r =
-	    region.topleft.r +
-	    (region.bottomright.r - region.topleft.r) * i / screen_region.w;
-	  unsigned iters = mandelbrot_iterate(c, maxiters);
-	  //	  fprintf(stderr, "%lf,%lf=%u(%lu) ", c.r, c.i, iters,colormap[iters]);
-	  Uint32 color =
-	    colormap[iters];
-	  putPixel(screen, screen_region.x + i, screen_region.y + j, color);
-	}
-      //      putchar('\n');
+  // A render server, if there is one, may have it already
+  complex unused = {0,0};
+  if (!renderclient_fetch(buf, ITERBUF_MANDELBROT, region, unused,
+			  screen_region.w, screen_region.h, maxiters))
+    {
+      sdlpanel_show(&panel, buf);
+      return;
     }
 
-  // unlock teh surface
-  if (SDL_MUSTLOCK(screen))
-    SDL_UnlockSurface(screen);
-
-  // update!
-  /*SDL_UpdateRect(screen, 
-		 screen_region.x, screen_region.y,
-		 screen_region.w, screen_region.h);*/
-  //  SDL_UpdateRect(screen, 0,0,0,0);
-    SDL_UpdateRects(screen, 1, &screen_region);
-
-
-}
+  if (buf->w != screen_region.w || buf->h != screen_region.h)
+    if (iterbuf_alloc(buf, screen_region.w, screen_region.h)) return;
 
-unsigned mandelbrot_iterate(complex c, unsigned maxiters)
-{
-  complex z = {0,0};
-  unsigned iters = 0;
-  while (++iters < maxiters && complex_sqmag(z) <= 4)
-    z = complex_add(complex_mult(z, z), c);
+  // Seen this view before? Then it's just a page-in
+  if (!itercache_load(buf, ITERBUF_MANDELBROT, region, unused,
+		      screen_region.w, screen_region.h, maxiters))
+    {
+      fprintf(stderr, "  Mandelbrot loaded from cache\n");
+      sdlpanel_show(&panel, buf);
+      return;
+    }
 
-  return iters;
+  iterbuf_render(buf, ITERBUF_MANDELBROT, region, unused, maxiters);
+  sdlpanel_show(&panel, buf);
+  iterbuf_refine(buf, MANDELBROT_BASE_SPAN, sdlpanel_show_part, &panel);
+  if (itercache_store(buf, maxiters))
+    fprintf(stderr, "  Couldn't save the Mandelbrot to the cache\n");
 }
 
-
 void draw_julia(SDL_Surface * screen,
 		complex_region region, SDL_Rect screen_region,
-		Uint32 * colormap,
+		iterbuf * buf,
 		unsigned maxiters,
 		complex c)
 {
-  printf("c=(%lf,%lf)\n", c.r, c.i);
-  // lock teh surface
-  if (SDL_MUSTLOCK(screen))
-    if (SDL_LockSurface(screen) < 0) return;
-    
-  int i,j;
-  for (j=0; j<screen_region.h; j++)
-    {
-      complex z = {0,0};
-      z.i = region.topleft.i +
-	(region.bottomright.i - region.topleft.i) * j / screen_region.h;
+  sdlpanel panel = { screen, screen_region, &colormap, 0 };
 
-      for (i=0; i<screen_region.w; i++)
-	{
-	  z.r =
-	    region.topleft.r +
-	    (region.bottomright.r - region.topleft.r) * i / screen_region.w;
-	  unsigned iters = julia_iterate(z,c,2, maxiters);
-	  //	  fprintf(stderr, "%lf,%lf=%u(%lu) ", c.r, c.i, iters,colormap[iters]);
-	  Uint32 color =
-	    colormap[iters];
-	  putPixel(screen, screen_region.x + i, screen_region.y + j, color);
-	}
-      //      putchar('\n');
+  printf("c=(%lf,%lf) maxiters=%u\n", c.r, c.i, maxiters);
+  if (!renderclient_fetch(buf, ITERBUF_JULIA, region, c,
+			  screen_region.w, screen_region.h, maxiters))
+    {
+      sdlpanel_show(&panel, buf);
+      return;
     }
 
-  // unlock teh surface
-  if (SDL_MUSTLOCK(screen))
-    SDL_UnlockSurface(screen);
-
-  // update!
-  /*  SDL_UpdateRect(screen, 
-		 screen_region.x, screen_region.y,
-		 screen_region.w, screen_region.h);*/
-  //  SDL_UpdateRect(screen, 0,0,0,0);
-  SDL_UpdateRects(screen, 1, &screen_region);
-
-
-}
-
-unsigned julia_iterate(complex z, const complex c, double escape,
-		       unsigned maxiters)
-{
-  unsigned iters = 0;
-  const double escsq = escape*escape;
-  while (++iters < maxiters && complex_sqmag(z) <= escsq)
-    z = complex_add(complex_mult(z, z), c);
+  if (buf->w != screen_region.w || buf->h != screen_region.h)
+    if (iterbuf_alloc(buf, screen_region.w, screen_region.h)) return;
 
-  return iters;
+  iterbuf_render(buf, ITERBUF_JULIA, region, c, maxiters);
+  sdlpanel_show(&panel, buf);
+  iterbuf_refine(buf, JULIA_BASE_SPAN, sdlpanel_show_part, &panel);
 }
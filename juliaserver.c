@@ -0,0 +1,367 @@
+/*
+  juliaserver
+  Renders iteration buffers for any number of juliapreview processes,
+  so the same frame is only ever computed once
+
+  USAGE:
+  juliaserver [-g GROUP] [SOCKETPATH]
+  Without a path it listens on $JULIAPREVIEW_SOCKET, or
+  $XDG_RUNTIME_DIR/juliapreview.sock (/tmp/juliapreview-UID.sock where
+  that isn't set). Clients find it the same way.
+    -g GROUP            hand the socket to GROUP, read/write for the
+                        group, so other accounts in it can connect
+
+  The default socket is per user. To share one server between
+  accounts, put them in a group and give every client the same path,
+  and the group to trust servers run by its members:
+    juliaserver -g fractals /srv/juliapreview/render.sock
+    export JULIAPREVIEW_SOCKET=/srv/juliapreview/render.sock
+    export JULIAPREVIEW_GROUP=fractals
+  (the directory needs to be searchable by the group as well).
+
+  Finished buffers are handed out as sealed memfds, so clients map them
+  rather than copy them. A request that matches one already being
+  rendered waits for that render instead of starting another. One that
+  only wants a finished buffer (RENDER_FINISHED_ONLY) is turned away
+  instead of waiting or starting a render. Finished
+  buffers stay around in memory (up to CACHE_BYTES) for whoever asks
+  next, and Mandelbrot panels also go through the on-disk cache.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "iterbuf.h"
+#include "itercache.h"
+#include "renderclient.h"
+
+typedef enum
+{
+  ENTRY_EMPTY,
+  ENTRY_RENDERING,
+  ENTRY_READY
+}
+entry_state;
+
+typedef struct
+{
+  iterbuf_key key;
+  entry_state state;
+  int fd;
+  size_t size;
+  unsigned maxiters;
+  unsigned unresolved;
+  int fixed;
+  unsigned long last_used;
+}
+cache_entry;
+
+/* Server parameters */
+#define CACHE_ENTRIES (256)
+#define CACHE_BYTES ((size_t) 512 << 20)
+#define MAX_SIDELENGTH (16384)
+
+cache_entry cache[CACHE_ENTRIES];
+size_t cache_bytes = 0;
+unsigned long use_clock = 0;
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cache_changed = PTHREAD_COND_INITIALIZER;
+
+/* Function prototypes */
+void * serve_client(void * arg);
+// Finds or makes the entry for a request, rendering it if need be and
+// allowed to
+cache_entry * get_entry(const render_request * req);
+int render_entry(const iterbuf_key * key, cache_entry * entry);
+int send_reply(int sock, const render_reply * reply, int fd);
+
+/* Main Function */
+int main (int argc, char * argv[])
+{
+  const char * group = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "g:")) != -1)
+    switch (opt)
+      {
+      case 'g': group = optarg; break;
+      default:
+        fprintf(stderr,"See the top of juliaserver.c for usage\n");
+        return -1;
+      }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (optind < argc)
+    {
+      if (strlen(argv[optind]) >= sizeof addr.sun_path)
+        { fprintf(stderr,"Socket path too long\n"); return -1; }
+      strcpy(addr.sun_path, argv[optind]);
+    }
+  else if (render_socket_path(addr.sun_path, sizeof addr.sun_path))
+    { fprintf(stderr,"Socket path too long\n"); return -1; }
+
+  // A client hanging up mid-reply shouldn't take the server with it
+  signal(SIGPIPE, SIG_IGN);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+    { fprintf(stderr,"Socket creation failed\n"); return -1; }
+  unlink(addr.sun_path);
+  if (bind(listener, (struct sockaddr *) &addr, sizeof addr) ||
+      listen(listener, 16))
+    {
+      fprintf(stderr,"Can't listen on %s: %s\n", addr.sun_path,
+              strerror(errno));
+      return -1;
+    }
+  // Connecting takes write permission on the socket
+  if (group)
+    {
+      struct group * g = getgrnam(group);
+      if (g == NULL)
+        { fprintf(stderr,"No group %s\n", group); return -1; }
+      if (chown(addr.sun_path, -1, g->gr_gid) ||
+          chmod(addr.sun_path, 0660))
+        {
+          fprintf(stderr,"Can't share %s with %s: %s\n", addr.sun_path,
+                  group, strerror(errno));
+          return -1;
+        }
+    }
+  fprintf(stderr,"Listening on %s\n", addr.sun_path);
+
+  while (1)
+    {
+      int client = accept(listener, NULL, NULL);
+      if (client < 0)
+        {
+          if (errno == EINTR) continue;
+          fprintf(stderr,"Accept failed: %s\n", strerror(errno));
+          return -1;
+        }
+
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, serve_client,
+                         (void *) (long) client))
+        {
+          fprintf(stderr,"Thread start failed\n");
+          close(client);
+          continue;
+        }
+      pthread_detach(thread);
+    }
+  return 0;
+}
+
+void * serve_client(void * arg)
+{
+  int sock = (int) (long) arg;
+  render_request req;
+
+  while (recv(sock, &req, sizeof req, MSG_WAITALL) == sizeof req)
+    {
+      render_reply reply = {-1, 0, 0, 0};
+      int fd = -1;
+
+      if (req.magic == RENDER_MAGIC &&
+          (req.kind == ITERBUF_MANDELBROT || req.kind == ITERBUF_JULIA) &&
+          req.kernel <= ITERBUF_KERNEL_FIXED &&
+          (req.flags & ~RENDER_FINISHED_ONLY) == 0 &&
+          req.w > 0 && req.h > 0 &&
+          req.w <= MAX_SIDELENGTH && req.h <= MAX_SIDELENGTH &&
+          req.maxiters >= 2 && req.maxiters <= MAXITERS_CAP)
+        {
+          pthread_mutex_lock(&cache_lock);
+          cache_entry * entry = get_entry(&req);
+          if (entry)
+            {
+              // Our own copy, so eviction can't close it under us
+              fd = dup(entry->fd);
+              reply.maxiters = entry->maxiters;
+              reply.unresolved = entry->unresolved;
+              reply.fixed = entry->fixed;
+            }
+          pthread_mutex_unlock(&cache_lock);
+          if (fd >= 0) reply.status = 0;
+        }
+
+      int failed = send_reply(sock, &reply, fd);
+      if (fd >= 0) close(fd);
+      if (failed) break;
+    }
+
+  close(sock);
+  return NULL;
+}
+
+static void evict(cache_entry * entry)
+{
+  close(entry->fd);
+  cache_bytes -= entry->size;
+  entry->state = ENTRY_EMPTY;
+}
+
+// Picks a slot for a new entry, evicting the least recently used ready
+// entries until both the slot and the byte budget are available
+static cache_entry * claim_entry(size_t size)
+{
+  while (1)
+    {
+      cache_entry * empty = NULL;
+      cache_entry * oldest = NULL;
+      unsigned i;
+      for (i=0; i<CACHE_ENTRIES; i++)
+        {
+          if (cache[i].state == ENTRY_EMPTY && empty == NULL)
+            empty = &cache[i];
+          if (cache[i].state == ENTRY_READY &&
+              (oldest == NULL || cache[i].last_used < oldest->last_used))
+            oldest = &cache[i];
+        }
+      if (empty && cache_bytes + size <= CACHE_BYTES)
+        return empty;
+      // Everything else is in flight; run over budget rather than wait
+      if (oldest == NULL)
+        return empty;
+      evict(oldest);
+    }
+}
+
+cache_entry * get_entry(const render_request * req)
+{
+  iterbuf_key key;
+  iterbuf_key_fill(&key, req->kind, req->kernel, req->region, req->c,
+                   req->w, req->h, req->maxiters);
+
+  while (1)
+    {
+      unsigned i;
+      cache_entry * found = NULL;
+      for (i=0; i<CACHE_ENTRIES; i++)
+        if (cache[i].state != ENTRY_EMPTY && iterbuf_key_equal(&cache[i].key, &key))
+          found = &cache[i];
+
+      if (found && found->state == ENTRY_READY)
+        {
+          found->last_used = ++use_clock;
+          return found;
+        }
+      if (req->flags & RENDER_FINISHED_ONLY)
+        return NULL;
+      if (found == NULL)
+        break;
+      // Somebody is already rendering this one; wait for theirs
+      pthread_cond_wait(&cache_changed, &cache_lock);
+    }
+
+  cache_entry * entry = claim_entry(iterbuf_mapping_size(key.w, key.h));
+  if (entry == NULL) return NULL;
+  entry->key = key;
+  entry->state = ENTRY_RENDERING;
+
+  pthread_mutex_unlock(&cache_lock);
+  int failed = render_entry(&key, entry);
+  pthread_mutex_lock(&cache_lock);
+
+  if (failed)
+    entry->state = ENTRY_EMPTY;
+  else
+    {
+      entry->state = ENTRY_READY;
+      entry->last_used = ++use_clock;
+      cache_bytes += entry->size;
+    }
+  pthread_cond_broadcast(&cache_changed);
+  return failed ? NULL : entry;
+}
+
+int render_entry(const iterbuf_key * key, cache_entry * entry)
+{
+  const size_t size = iterbuf_mapping_size(key->w, key->h);
+  int fd = memfd_create("juliapreview", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) return -1;
+  if (ftruncate(fd, size))
+    {
+      close(fd);
+      return -1;
+    }
+  void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    {
+      close(fd);
+      return -1;
+    }
+
+  iterbuf buf;
+  memset(&buf, 0, sizeof buf);
+  iterbuf_map(&buf, map, key->w, key->h);
+  buf.kernel = key->kernel;
+
+  if (key->kind == ITERBUF_MANDELBROT &&
+      !itercache_load(&buf, key->kind, key->region, key->c,
+                      key->w, key->h, key->start_maxiters))
+    fprintf(stderr,"  %dx%d Mandelbrot from disk\n", key->w, key->h);
+  else
+    {
+      double base_span = key->kind == ITERBUF_JULIA ?
+        JULIA_BASE_SPAN : MANDELBROT_BASE_SPAN;
+      fprintf(stderr,"  rendering %dx%d %s\n", key->w, key->h,
+              key->kind == ITERBUF_JULIA ? "Julia" : "Mandelbrot");
+      iterbuf_render(&buf, key->kind, key->region, key->c,
+                     key->start_maxiters);
+      iterbuf_refine(&buf, base_span, NULL, NULL);
+      if (key->kind == ITERBUF_MANDELBROT)
+        itercache_store(&buf, key->start_maxiters);
+    }
+
+  entry->fd = fd;
+  entry->size = size;
+  entry->maxiters = buf.maxiters;
+  entry->unresolved = buf.unresolved;
+  entry->fixed = buf.fixed;
+
+  // Drop our writable mapping so the contents can be sealed for good
+  iterbuf_free(&buf);
+  if (fcntl(fd, F_ADD_SEALS, RENDER_SEALS))
+    {
+      close(fd);
+      return -1;
+    }
+  return 0;
+}
+
+int send_reply(int sock, const render_reply * reply, int fd)
+{
+  struct iovec iov = { (void *) reply, sizeof *reply };
+  struct msghdr msg;
+  char control[CMSG_SPACE(sizeof(int))];
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (fd >= 0)
+    {
+      memset(control, 0, sizeof control);
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof control;
+      struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+    }
+
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof *reply ? 0 : -1;
+}
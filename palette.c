@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include "palette.h"
+
+uint32_t palette_rgb(unsigned iters, unsigned period)
+{
+  iters %= (period * 3);
+  uint32_t value =
+    (iters % period) * 255 / period;
+  if (iters >= (period * 2))
+    return value << 16;
+  else if (iters >= period)
+    return value << 8;
+  else
+    return value;
+}
+
+uint32_t * palette_build(unsigned size, unsigned period)
+{
+  uint32_t * colormap = malloc(sizeof(uint32_t) * size);
+  if (colormap == NULL) return NULL;
+
+  unsigned i;
+  for (i=0; i<size; i++)
+    colormap[i] = palette_rgb(i, period);
+  return colormap;
+}
+
+int palette_write_ppm(FILE * f, const uint32_t * pixels, int w, int h)
+{
+  if (fprintf(f, "P6\n%d %d\n255\n", w, h) < 0) return -1;
+
+  // A row at a time keeps the scratch small for big images
+  unsigned char * row = malloc(3 * (size_t) w);
+  if (row == NULL) return -1;
+  int i,j;
+  int failed = 0;
+  for (j=0; j<h && !failed; j++)
+    {
+      const uint32_t * in = pixels + (size_t) j * w;
+      for (i=0; i<w; i++)
+        {
+          row[3 * i] = (in[i] >> 16) & 0xff;
+          row[3 * i + 1] = (in[i] >> 8) & 0xff;
+          row[3 * i + 2] = in[i] & 0xff;
+        }
+      failed = fwrite(row, 1, 3 * (size_t) w, f) != 3 * (size_t) w;
+    }
+  free(row);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,18 @@
+#ifndef __PALETTE_H
+#define __PALETTE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+  The viewer's blue/green/red banding for the headless tools, packed as
+  0x00RRGGBB since there is no SDL surface format to map through.
+*/
+uint32_t palette_rgb(unsigned iters, unsigned period);
+/* A colormap covering counts 0 .. size-1. NULL if out of memory. */
+uint32_t * palette_build(unsigned size, unsigned period);
+
+/* Writes packed pixels out as a binary PPM. Returns 0 on success. */
+int palette_write_ppm(FILE * f, const uint32_t * pixels, int w, int h);
+
+#endif
@@ -0,0 +1,381 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "itercache.h"
+#include "pyramid.h"
+#include "renderclient.h"
+
+// Rounds toward minus infinity, since views can sit left of the origin
+static long floor_div(long a, long b)
+{
+  return a >= 0 ? a / b : -((-a - 1) / b) - 1;
+}
+
+static size_t tile_bytes(void)
+{
+  return iterbuf_mapping_size(PYRAMID_TILE, PYRAMID_TILE);
+}
+
+static complex_region tile_region(const pyramid * p, int level,
+                                  long tx, long ty)
+{
+  // Scaling by a power of two is exact, so neighbours share edges
+  complex_region r;
+  r.topleft.r = p->origin.r + ldexp(tx * p->tile_span.r, -level);
+  r.topleft.i = p->origin.i + ldexp(ty * p->tile_span.i, -level);
+  r.bottomright.r = p->origin.r + ldexp((tx + 1) * p->tile_span.r, -level);
+  r.bottomright.i = p->origin.i + ldexp((ty + 1) * p->tile_span.i, -level);
+  return r;
+}
+
+int pyramid_init(pyramid * p, complex origin, complex tile_span,
+                 double base_span, unsigned start_maxiters, size_t budget)
+{
+  memset(p, 0, sizeof *p);
+  p->origin = origin;
+  p->tile_span = tile_span;
+  p->base_span = base_span;
+  p->start_maxiters = start_maxiters;
+  p->budget = budget;
+  memset(p->level_fixed, -1, sizeof p->level_fixed);
+  p->ntiles = budget / tile_bytes();
+  if (p->ntiles < 16) p->ntiles = 16;
+  p->tiles = calloc(p->ntiles, sizeof(pyramid_tile));
+  return p->tiles ? 0 : -1;
+}
+
+void pyramid_free(pyramid * p)
+{
+  unsigned k;
+  for (k=0; k<p->ntiles; k++)
+    iterbuf_free(&p->tiles[k].buf);
+  free(p->tiles);
+  memset(p, 0, sizeof *p);
+}
+
+complex_region pyramid_view_region(const pyramid * p,
+                                   const pyramid_view * view)
+{
+  const double scale = ldexp(1.0 / PYRAMID_TILE, -view->level);
+  complex_region r;
+  r.topleft.r = p->origin.r + view->x * p->tile_span.r * scale;
+  r.topleft.i = p->origin.i + view->y * p->tile_span.i * scale;
+  r.bottomright.r = p->origin.r + (view->x + view->w) * p->tile_span.r * scale;
+  r.bottomright.i = p->origin.i + (view->y + view->h) * p->tile_span.i * scale;
+  return r;
+}
+
+void pyramid_zoom(pyramid_view * view, int steps)
+{
+  long cx = view->x + view->w / 2;
+  long cy = view->y + view->h / 2;
+  for (; steps > 0 && view->level < PYRAMID_MAX_LEVEL; steps--)
+    {
+      view->level++;
+      cx *= 2;
+      cy *= 2;
+    }
+  for (; steps < 0 && view->level > 0; steps++)
+    {
+      view->level--;
+      cx = floor_div(cx, 2);
+      cy = floor_div(cy, 2);
+    }
+  view->x = cx - view->w / 2;
+  view->y = cy - view->h / 2;
+}
+
+static int find_tile(const pyramid * p, int level, long tx, long ty)
+{
+  unsigned k;
+  for (k=0; k<p->ntiles; k++)
+    {
+      const pyramid_tile * t = &p->tiles[k];
+      if (t->buf.w && t->level == level && t->tx == tx && t->ty == ty)
+        return k;
+    }
+  return -1;
+}
+
+static void drop(pyramid * p, pyramid_tile * t)
+{
+  iterbuf_free(&t->buf);
+  p->bytes -= tile_bytes();
+}
+
+// Out of memory, onto disk unless the disk has it already
+static void evict(pyramid * p, pyramid_tile * t)
+{
+  if (!t->saved)
+    itercache_store(&t->buf, p->start_maxiters);
+  drop(p, t);
+}
+
+/*
+  Picks a slot for a new tile, evicting the least recently used tiles
+  until both the slot and the byte budget are available. Tiles touched
+  since the clock last ticked belong to the view being drawn and stay;
+  if that is all there is, run over budget rather than thrash.
+*/
+static int claim_slot(pyramid * p)
+{
+  while (1)
+    {
+      int empty = -1, oldest = -1;
+      unsigned k;
+      for (k=0; k<p->ntiles; k++)
+        {
+          const pyramid_tile * t = &p->tiles[k];
+          if (t->buf.w == 0 && empty < 0)
+            empty = k;
+          if (t->buf.w && t->last_used < p->clock &&
+              (oldest < 0 || t->last_used < p->tiles[oldest].last_used))
+            oldest = k;
+        }
+      if (empty >= 0 && p->bytes + tile_bytes() <= p->budget)
+        return empty;
+      if (oldest < 0)
+        {
+          if (empty >= 0) return empty;
+          pyramid_tile * grown =
+            realloc(p->tiles, sizeof(pyramid_tile) * p->ntiles * 2);
+          if (grown == NULL) return -1;
+          memset(grown + p->ntiles, 0, sizeof(pyramid_tile) * p->ntiles);
+          p->tiles = grown;
+          p->ntiles *= 2;
+          continue;
+        }
+      evict(p, &p->tiles[oldest]);
+    }
+}
+
+// The kernel a tile is asked for: its level's, and while AUTO has yet
+// to settle the level, fixed point wherever fixed point may go
+static iterbuf_kernel tile_kernel(const pyramid * p, int level,
+                                  complex_region region)
+{
+  iterbuf probe;
+
+  if (p->kernel != ITERBUF_KERNEL_AUTO) return p->kernel;
+  if (p->level_fixed[level] == 0 || !iterbatch_simd())
+    return ITERBUF_KERNEL_DOUBLE;
+  memset(&probe, 0, sizeof probe);
+  probe.kind = ITERBUF_MANDELBROT;
+  probe.region = region;
+  probe.w = probe.full_w = PYRAMID_TILE;
+  probe.h = probe.full_h = PYRAMID_TILE;
+  return iterbuf_fixed_permitted(&probe) ?
+    ITERBUF_KERNEL_FIXED : ITERBUF_KERNEL_DOUBLE;
+}
+
+// Brings a tile into memory by the cheapest way going
+static int fetch_tile(pyramid * p, int level, long tx, long ty)
+{
+  int k = find_tile(p, level, tx, ty);
+  if (k >= 0)
+    {
+      p->tiles[k].last_used = p->clock;
+      return k;
+    }
+
+  k = claim_slot(p);
+  if (k < 0) return -1;
+  pyramid_tile * t = &p->tiles[k];
+  memset(t, 0, sizeof *t);
+  t->level = level;
+  t->tx = tx;
+  t->ty = ty;
+
+  complex_region region = tile_region(p, level, tx, ty);
+  complex unused = {0,0};
+  const iterbuf_kernel kernel = tile_kernel(p, level, region);
+  const int fixed = kernel == ITERBUF_KERNEL_FIXED;
+  t->buf.kernel = kernel;
+
+  // Anything in the other kernel would show as a seam, so gets redone
+  int have = !renderclient_fetch(&t->buf, ITERBUF_MANDELBROT, region, unused,
+                                 PYRAMID_TILE, PYRAMID_TILE,
+                                 p->start_maxiters) &&
+    t->buf.fixed == fixed;
+  if (!have)
+    {
+      if (iterbuf_alloc(&t->buf, PYRAMID_TILE, PYRAMID_TILE))
+        {
+          iterbuf_free(&t->buf);
+          return -1;
+        }
+      if (!itercache_load(&t->buf, ITERBUF_MANDELBROT, region, unused,
+                          PYRAMID_TILE, PYRAMID_TILE, p->start_maxiters) &&
+          t->buf.fixed == fixed)
+        t->saved = 1;
+      else
+        {
+          iterbuf_render(&t->buf, ITERBUF_MANDELBROT, region, unused,
+                         p->start_maxiters);
+          iterbuf_refine(&t->buf, p->base_span, NULL, NULL);
+          // Saved now, so the next run starts from disk
+          t->saved = !itercache_store(&t->buf, p->start_maxiters);
+        }
+    }
+
+  p->bytes += tile_bytes();
+  t->last_used = p->clock;
+  if (t->buf.maxiters > p->maxiters) p->maxiters = t->buf.maxiters;
+  return k;
+}
+
+/*
+  Settles an AUTO level on the first view drawn on it, whose tiles came
+  in fixed point where they could: spot-checked all together, they keep
+  the level in fixed point or send it, and them, back to double. A view
+  with no fixed-point tiles settles nothing. Returns 0 on success.
+*/
+static int settle_level(pyramid * p, const pyramid_view * view,
+                        long tx0, long ty0, long tx1, long ty1)
+{
+  unsigned checked = 0, mismatched = 0;
+  long tx, ty;
+
+  for (ty=ty0; ty<=ty1; ty++)
+    for (tx=tx0; tx<=tx1; tx++)
+      {
+        const pyramid_tile * t =
+          &p->tiles[find_tile(p, view->level, tx, ty)];
+        if (t->buf.fixed)
+          iterbuf_spot_check(&t->buf, &checked, &mismatched);
+      }
+  if (checked == 0) return 0;
+  p->level_fixed[view->level] =
+    mismatched * 100 <= checked * FIXED_MAX_MISMATCH_PCT;
+  if (p->level_fixed[view->level]) return 0;
+
+  for (ty=ty0; ty<=ty1; ty++)
+    for (tx=tx0; tx<=tx1; tx++)
+      {
+        pyramid_tile * t = &p->tiles[find_tile(p, view->level, tx, ty)];
+        if (!t->buf.fixed) continue;
+        drop(p, t);
+        if (fetch_tile(p, view->level, tx, ty) < 0) return -1;
+      }
+  return 0;
+}
+
+unsigned pyramid_render_view(pyramid * p, const pyramid_view * view)
+{
+  const long tx0 = floor_div(view->x, PYRAMID_TILE);
+  const long ty0 = floor_div(view->y, PYRAMID_TILE);
+  const long tx1 = floor_div(view->x + view->w - 1, PYRAMID_TILE);
+  const long ty1 = floor_div(view->y + view->h - 1, PYRAMID_TILE);
+  unsigned maxiters = 0;
+  long tx, ty;
+
+  // Everything this view touches from here on is pinned
+  p->clock++;
+  for (ty=ty0; ty<=ty1; ty++)
+    for (tx=tx0; tx<=tx1; tx++)
+      if (fetch_tile(p, view->level, tx, ty) < 0) return 0;
+  if (p->kernel == ITERBUF_KERNEL_AUTO && p->level_fixed[view->level] < 0 &&
+      settle_level(p, view, tx0, ty0, tx1, ty1))
+    return 0;
+
+  for (ty=ty0; ty<=ty1; ty++)
+    for (tx=tx0; tx<=tx1; tx++)
+      {
+        const pyramid_tile * t = &p->tiles[find_tile(p, view->level, tx, ty)];
+        if (t->buf.maxiters > maxiters) maxiters = t->buf.maxiters;
+      }
+
+  // Tiles refine on their own histograms; level them so no seams show
+  for (ty=ty0; ty<=ty1; ty++)
+    for (tx=tx0; tx<=tx1; tx++)
+      {
+        pyramid_tile * t = &p->tiles[find_tile(p, view->level, tx, ty)];
+        if (t->buf.maxiters < maxiters)
+          {
+            iterbuf_extend(&t->buf, maxiters);
+            t->saved = 0;
+          }
+      }
+  if (maxiters > p->maxiters) p->maxiters = maxiters;
+  return maxiters;
+}
+
+// Paints level pixels x0..x0+w, y0..y0+h from an ancestor depth levels
+// up, whose top left pixel (on its own level) is ax, ay
+static void paint_scaled(const iterbuf * buf, int depth, long ax, long ay,
+                         long x0, long y0, int w, int h,
+                         const uint32_t * colormap, uint32_t inside,
+                         uint32_t * pixels, int pitch)
+{
+  const long factor = 1L << depth;
+  int i,j;
+  for (j=0; j<h; j++)
+    {
+      const int y = floor_div(y0 + j, factor) - ay;
+      uint32_t * out = pixels + (size_t) j * pitch;
+      for (i=0; i<w; i++)
+        {
+          const int x = floor_div(x0 + i, factor) - ax;
+          unsigned iters = buf->iters[iterbuf_index(buf, x, y)];
+          out[i] = iters >= buf->maxiters ? inside : colormap[iters];
+        }
+    }
+}
+
+void pyramid_paint(pyramid * p, const pyramid_view * view,
+                   const uint32_t * colormap, uint32_t inside,
+                   uint32_t * pixels, int pitch)
+{
+  const long tx0 = floor_div(view->x, PYRAMID_TILE);
+  const long ty0 = floor_div(view->y, PYRAMID_TILE);
+  const long tx1 = floor_div(view->x + view->w - 1, PYRAMID_TILE);
+  const long ty1 = floor_div(view->y + view->h - 1, PYRAMID_TILE);
+  long tx, ty;
+
+  for (ty=ty0; ty<=ty1; ty++)
+    for (tx=tx0; tx<=tx1; tx++)
+      {
+        // The part of this tile inside the view, in level pixels
+        long x0 = tx * PYRAMID_TILE, y0 = ty * PYRAMID_TILE;
+        long x1 = x0 + PYRAMID_TILE, y1 = y0 + PYRAMID_TILE;
+        if (x0 < view->x) x0 = view->x;
+        if (y0 < view->y) y0 = view->y;
+        if (x1 > view->x + view->w) x1 = view->x + view->w;
+        if (y1 > view->y + view->h) y1 = view->y + view->h;
+        const int w = x1 - x0, h = y1 - y0;
+        uint32_t * out = pixels + (size_t) (y0 - view->y) * pitch
+          + (x0 - view->x);
+
+        int k = find_tile(p, view->level, tx, ty);
+        if (k >= 0)
+          {
+            p->tiles[k].last_used = p->clock;
+            iterbuf_colorize_rect(&p->tiles[k].buf,
+                                  x0 - tx * PYRAMID_TILE,
+                                  y0 - ty * PYRAMID_TILE, w, h,
+                                  colormap, inside, out, pitch);
+            continue;
+          }
+
+        // Not here yet; the closest ancestor we have stands in for it
+        int depth;
+        for (depth=1; depth<=view->level; depth++)
+          {
+            const long factor = 1L << depth;
+            const long atx = floor_div(tx, factor);
+            const long aty = floor_div(ty, factor);
+            k = find_tile(p, view->level - depth, atx, aty);
+            if (k < 0) continue;
+            paint_scaled(&p->tiles[k].buf, depth,
+                         atx * PYRAMID_TILE, aty * PYRAMID_TILE,
+                         x0, y0, w, h, colormap, inside, out, pitch);
+            break;
+          }
+        if (depth <= view->level) continue;
+
+        int i,j;
+        for (j=0; j<h; j++)
+          for (i=0; i<w; i++)
+            out[(size_t) j * pitch + i] = inside;
+      }
+}
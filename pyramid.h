@@ -0,0 +1,104 @@
+#ifndef __PYRAMID_H
+#define __PYRAMID_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "iterbuf.h"
+
+/*
+  Quadtree tile pyramid of Mandelbrot iteration buffers. Every level is
+  a grid of PYRAMID_TILE square tiles, each level with twice the
+  resolution of the one before, all hung off the same origin. A view is
+  a level plus a pixel rectangle on it, so zooming is a change of level
+  and panning a change of rectangle, and any tile rendered once serves
+  every later view that overlaps it.
+
+  Tiles are kept in memory up to a byte budget. Past that the least
+  recently used ones are written to the disk cache (itercache), and a
+  tile that isn't in memory is asked of juliaserver, then the disk
+  cache, before it is rendered; rendered tiles go straight to the disk
+  cache too. While a view's tiles are on their way, the nearest
+  ancestor already in memory is scaled up to stand in.
+
+  Every tile of a level is rendered with the same kernel, so no seams
+  show where fixed point and double would round differently. With
+  kernel AUTO, a level whose pixel spacing allows fixed point (and
+  where the AVX2 lanes run) has the first view drawn on it rendered in
+  fixed point and spot-checked as a whole, all its tiles together; the
+  level stays in fixed point if that passes and is redone in double if
+  not. The kernel is in the tiles' keys, so juliaserver and the disk
+  cache hand back tiles of the level's kernel, and any that turn out
+  otherwise are rendered again here. Tiles outside fixed point's range
+  are double whatever the level, which is seamless since every pixel
+  there escapes within a step or two either way.
+*/
+
+#define PYRAMID_TILE (128)          // tile side, in pixels
+#define PYRAMID_MAX_LEVEL (40)      // past this doubles run out of bits
+#define PYRAMID_BYTES ((size_t) 64 << 20)
+
+typedef struct
+{
+  int level;
+  long tx, ty;
+  iterbuf buf;            // w == 0 while the slot is free
+  int saved;              // the disk cache has it as it stands
+  unsigned long last_used;
+}
+pyramid_tile;
+
+typedef struct
+{
+  complex origin;         // top left of tile (0,0) on every level
+  complex tile_span;      // plane extent of a level 0 tile
+  double base_span;       // what a level 0 tile counts as for budgets
+  unsigned start_maxiters;
+  unsigned maxiters;      // highest budget of any tile so far
+  iterbuf_kernel kernel;  // as asked for; AUTO unless set after init
+  // Under AUTO, whether each level is in fixed point; -1 until settled
+  signed char level_fixed[PYRAMID_MAX_LEVEL + 1];
+  size_t budget, bytes;
+  pyramid_tile * tiles;
+  unsigned ntiles;
+  unsigned long clock;
+}
+pyramid;
+
+/* A rectangle of pixels on one level, in pixels from the origin */
+typedef struct
+{
+  int level;
+  long x, y;
+  int w, h;
+}
+pyramid_view;
+
+/* Returns 0 on success. base_span is the width a level 0 tile would
+   have at the fractal's default zoom, for the budget's zoom floor. */
+int pyramid_init(pyramid * p, complex origin, complex tile_span,
+                 double base_span, unsigned start_maxiters, size_t budget);
+void pyramid_free(pyramid * p);
+
+complex_region pyramid_view_region(const pyramid * p,
+                                   const pyramid_view * view);
+/* Moves the view in (or out, for negative steps) by whole levels,
+   keeping its center where it is */
+void pyramid_zoom(pyramid_view * view, int steps);
+
+/*
+  Gets every tile of the view into memory, rendering what it has to,
+  and brings them all up to one budget so no seams show. Returns that
+  budget, or 0 if tiles couldn't be allocated.
+*/
+unsigned pyramid_render_view(pyramid * p, const pyramid_view * view);
+
+/*
+  Colors the view from whatever is in memory, with ancestors scaled up
+  in place of missing tiles, and the inside color where there is
+  nothing at all. The colormap must cover p->maxiters.
+*/
+void pyramid_paint(pyramid * p, const pyramid_view * view,
+                   const uint32_t * colormap, uint32_t inside,
+                   uint32_t * pixels, int pitch);
+
+#endif
@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "renderclient.h"
+
+static int server = -1;
+// The socket server is connected to, or last failed to connect to
+static char tried[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+
+int render_socket_path(char * path, size_t len)
+{
+  const char * env = getenv(RENDER_SOCKET_ENV);
+  const char * runtime = getenv("XDG_RUNTIME_DIR");
+  if (env && *env)
+    snprintf(path, len, "%s", env);
+  else if (runtime && *runtime)
+    snprintf(path, len, RENDER_SOCKET_DEFAULT, runtime);
+  else
+    snprintf(path, len, RENDER_SOCKET_FALLBACK, (unsigned) getuid());
+  return strlen(path) < len - 1 ? 0 : -1;
+}
+
+// Whether uid is in the group, as its primary group or otherwise
+static int in_group(uid_t uid, gid_t gid, const struct group * g)
+{
+  if (gid == g->gr_gid) return 1;
+  const struct passwd * pw = getpwuid(uid);
+  if (pw == NULL) return 0;
+  if (pw->pw_gid == g->gr_gid) return 1;
+  char ** member;
+  for (member=g->gr_mem; *member; member++)
+    if (strcmp(*member, pw->pw_name) == 0) return 1;
+  return 0;
+}
+
+// Whoever is listening could hand us anything, so it has to be us,
+// root, or someone in the group we were told to trust
+static int trusted(int fd)
+{
+  struct ucred cred;
+  socklen_t len = sizeof cred;
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) ||
+      len != sizeof cred)
+    return 0;
+  if (cred.uid == getuid() || cred.uid == 0) return 1;
+
+  const char * group = getenv(RENDER_GROUP_ENV);
+  if (group == NULL || *group == 0) return 0;
+  const struct group * g = getgrnam(group);
+  return g && in_group(cred.uid, cred.gid, g);
+}
+
+static int connect_server(const char * path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof addr.sun_path, "%s", path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  if (connect(fd, (struct sockaddr *) &addr, sizeof addr))
+    {
+      close(fd);
+      return -1;
+    }
+  if (!trusted(fd))
+    {
+      fprintf(stderr,"Not trusting the render server at %s\n",
+              addr.sun_path);
+      close(fd);
+      return -1;
+    }
+  fprintf(stderr,"Using render server at %s\n", addr.sun_path);
+  return fd;
+}
+
+// Gives up on the server for good; we render locally from here on
+static int drop_server(void)
+{
+  if (server >= 0)
+    {
+      fprintf(stderr,"Lost the render server; rendering locally\n");
+      close(server);
+    }
+  server = -1;
+  return -1;
+}
+
+static int request(iterbuf * buf, iterbuf_kind kind,
+                   complex_region region, complex c,
+                   int w, int h, unsigned maxiters, unsigned flags)
+{
+  char path[sizeof tried];
+  if (render_socket_path(path, sizeof path)) return -1;
+  if (strcmp(path, tried))
+    {
+      if (server >= 0) close(server);
+      memcpy(tried, path, sizeof tried);
+      server = connect_server(path);
+    }
+  if (server < 0) return -1;
+
+  render_request req;
+  memset(&req, 0, sizeof req);
+  req.magic = RENDER_MAGIC;
+  req.kind = kind;
+  req.kernel = buf->kernel;
+  req.flags = flags;
+  req.w = w;
+  req.h = h;
+  req.maxiters = maxiters;
+  req.region = region;
+  req.c = c;
+  if (send(server, &req, sizeof req, MSG_NOSIGNAL) != sizeof req)
+    return drop_server();
+
+  // The reply, with the buffer's descriptor riding along
+  render_reply reply;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &reply, sizeof reply };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof control;
+  if (recvmsg(server, &msg, MSG_WAITALL) != sizeof reply)
+    return drop_server();
+
+  int fd = -1;
+  struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+  if (reply.status || fd < 0)
+    {
+      if (fd >= 0) close(fd);
+      return -1;
+    }
+
+  // Nothing that could change under us, come up short, or send the
+  // colormap code off to a budget no render would reach
+  size_t size = iterbuf_mapping_size(w, h);
+  struct stat st;
+  const int seals = fcntl(fd, F_GET_SEALS);
+  if (reply.maxiters > MAXITERS_CAP ||
+      reply.unresolved > (unsigned) w * h ||
+      fstat(fd, &st) || st.st_size < 0 || (size_t) st.st_size < size ||
+      seals < 0 || (seals & RENDER_SEALS) != RENDER_SEALS)
+    {
+      close(fd);
+      return drop_server();
+    }
+
+  void * map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+
+  iterbuf_map(buf, map, w, h);
+  buf->kind = kind;
+  buf->region = region;
+  buf->c = c;
+  buf->maxiters = reply.maxiters;
+  buf->unresolved = reply.unresolved;
+  buf->fixed = reply.fixed;
+  return 0;
+}
+
+int renderclient_fetch(iterbuf * buf, iterbuf_kind kind,
+                       complex_region region, complex c,
+                       int w, int h, unsigned maxiters)
+{
+  return request(buf, kind, region, c, w, h, maxiters, 0);
+}
+
+int renderclient_lookup(iterbuf * buf, iterbuf_kind kind,
+                        complex_region region, complex c,
+                        int w, int h, unsigned maxiters)
+{
+  return request(buf, kind, region, c, w, h, maxiters, RENDER_FINISHED_ONLY);
+}
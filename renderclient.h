@@ -0,0 +1,83 @@
+#ifndef __RENDERCLIENT_H
+#define __RENDERCLIENT_H
+
+#include "iterbuf.h"
+
+/*
+  Talking to juliaserver, the shared render daemon.
+
+  The server listens on a Unix domain socket at $JULIAPREVIEW_SOCKET, or
+  RENDER_SOCKET_DEFAULT in $XDG_RUNTIME_DIR (RENDER_SOCKET_FALLBACK,
+  with the user's uid filled in, where that isn't set); the top of
+  juliaserver.c has how to share one between accounts. A client sends
+  a render_request and gets back a render_reply with the finished
+  buffer's file descriptor attached (SCM_RIGHTS). The descriptor is a
+  sealed memfd laid out as iterbuf_mapping_size describes, so mapping it
+  is the whole transfer.
+
+  Clients only take buffers from a server running as their own user
+  (or root), or as a member of the group named by $JULIAPREVIEW_GROUP,
+  and check what comes back before using it: the seals, the memfd's
+  size, and the reply's budget and counts.
+*/
+
+#define RENDER_SOCKET_ENV "JULIAPREVIEW_SOCKET"
+#define RENDER_GROUP_ENV "JULIAPREVIEW_GROUP"
+#define RENDER_SOCKET_DEFAULT "%s/juliapreview.sock"
+#define RENDER_SOCKET_FALLBACK "/tmp/juliapreview-%u.sock"
+// What a server must have sealed its buffers with
+#define RENDER_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+/* Also the protocol version: it changes whenever the mapping's layout
+   does, so old clients and servers turn each other away rather than
+   misread a buffer. "JPQ4" has counts and orbits in ITERBUF_BLOCK
+   blocks, and the kernel and flags in the request. */
+#define RENDER_MAGIC (0x3451504a) // "JPQ4"
+
+/* Request flags */
+// Answer only with a buffer that's already finished; never render
+#define RENDER_FINISHED_ONLY (1)
+
+typedef struct
+{
+  unsigned magic;
+  unsigned kind;
+  unsigned kernel;         // an iterbuf_kernel; part of the key
+  unsigned flags;          // RENDER_* request flags
+  int w, h;
+  unsigned maxiters;       // starting budget; the server refines from it
+  complex_region region;
+  complex c;
+}
+render_request;
+
+typedef struct
+{
+  int status;              // 0 when a buffer is attached
+  unsigned maxiters;
+  unsigned unresolved;
+  int fixed;               // rendered with the fixed-point kernel
+}
+render_reply;
+
+/* Fills the path the server listens on. Returns 0 on success. */
+int render_socket_path(char * path, size_t len);
+
+/*
+  Asks the server for a buffer rendered with buf->kernel and maps the
+  answer into buf (privately, so the client may still extend it).
+  Returns 0 on success; -1 when
+  there is no server, in which case the caller should render locally.
+  After a failed connection, or a server it doesn't trust, it stops
+  trying until the socket path changes.
+*/
+int renderclient_fetch(iterbuf * buf, iterbuf_kind kind,
+                       complex_region region, complex c,
+                       int w, int h, unsigned maxiters);
+/* Same, but only if the server has the buffer finished already, so a
+   caller that can show its own render a piece at a time isn't left
+   waiting on the server's whole one. Returns -1 on a miss as well. */
+int renderclient_lookup(iterbuf * buf, iterbuf_kind kind,
+                        complex_region region, complex c,
+                        int w, int h, unsigned maxiters);
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include "palette.h"
+#include "sdlpanel.h"
+
+int sdlpanel_grow_colormap(sdlpanel_colormap * map,
+                           SDL_PixelFormat * format,
+                           unsigned maxiters)
+{
+  if (maxiters < map->size) return 0;
+
+  unsigned size = map->size ? map->size : 256;
+  while (size <= maxiters) size *= 2;
+  Uint32 * grown = realloc(map->colors, sizeof(Uint32) * size);
+  if (grown == NULL) return -1;
+
+  // Only the new entries need filling; the old ones keep their colors
+  unsigned i;
+  for (i=map->size; i<size; i++)
+    {
+      uint32_t rgb = palette_rgb(i, map->period);
+      grown[i] = SDL_MapRGB(format,
+                            rgb >> 16, (rgb >> 8) & 0xff, rgb & 0xff);
+    }
+  map->colors = grown;
+  map->size = size;
+  return 0;
+}
+
+void sdlpanel_show(const sdlpanel * panel, const iterbuf * buf)
+{
+  sdlpanel_show_part(buf, 0, 0, buf->w, buf->h, (void *) panel);
+}
+
+void sdlpanel_show_part(const iterbuf * buf, int x, int y, int w, int h,
+                        void * arg)
+{
+  const sdlpanel * panel = arg;
+  SDL_Surface * surface = panel->surface;
+  SDL_Rect rect = { panel->screen_region.x + x,
+                    panel->screen_region.y + y, w, h };
+
+  if (sdlpanel_grow_colormap(panel->colormap, surface->format,
+                             buf->maxiters))
+    return;
+
+  // lock teh surface
+  if (SDL_MUSTLOCK(surface))
+    if (SDL_LockSurface(surface) < 0) return;
+
+  iterbuf_colorize_rect(buf, x, y, w, h, panel->colormap->colors,
+                        SDL_MapRGB(surface->format, 0, 0, 0),
+                        (Uint32 *) surface->pixels
+                        + rect.x + (surface->pitch >> 2) * rect.y,
+                        surface->pitch >> 2);
+
+  // unlock teh surface
+  if (SDL_MUSTLOCK(surface))
+    SDL_UnlockSurface(surface);
+
+  // update!
+  if (panel->update)
+    SDL_UpdateRects(surface, 1, &rect);
+}
@@ -0,0 +1,45 @@
+#ifndef __SDLPANEL_H
+#define __SDLPANEL_H
+
+#include <SDL/SDL.h>
+#include "iterbuf.h"
+
+/*
+  The SDL end of showing iteration buffers, shared by juliapreview and
+  juliapreview2: a colormap in the display's pixel format, and drawing
+  a buffer (or part of one) into its panel of a surface.
+*/
+
+typedef struct
+{
+  Uint32 * colors;
+  unsigned size;          // grows along with the largest budget seen
+  int period;             // palette_rgb's color period
+}
+sdlpanel_colormap;
+
+/* Where a buffer gets drawn */
+typedef struct
+{
+  SDL_Surface * surface;
+  SDL_Rect screen_region;     // the buffer's panel on surface
+  sdlpanel_colormap * colormap;
+  int update;                 // put what's drawn on screen right away
+}
+sdlpanel;
+
+/* Makes sure the colormap covers counts up to maxiters, mapping the
+   palette through format. Returns 0 on success. */
+int sdlpanel_grow_colormap(sdlpanel_colormap * map,
+                           SDL_PixelFormat * format,
+                           unsigned maxiters);
+
+/* Colors the whole buffer into its panel */
+void sdlpanel_show(const sdlpanel * panel, const iterbuf * buf);
+/* Same, for the w x h part at x, y only; an iterbuf_progress, so it
+   can go straight to iterbuf_refine or iterbuf_render_focused with
+   the panel as arg */
+void sdlpanel_show_part(const iterbuf * buf, int x, int y, int w, int h,
+                        void * panel);
+
+#endif